@@ -0,0 +1,94 @@
+// Statements between traversal calls that must keep their position with
+// -fuse-non-adjacent: each of them accesses data passed to the calls without
+// naming the same variable. The fused and the unfused programs must print
+// the same values.
+#include <stdio.h>
+
+#define __tree_structure__ __attribute__((annotate("tf_tree")))
+#define __tree_child__ __attribute__((annotate("tf_child")))
+#define __tree_traversal__ __attribute__((annotate("tf_fuse")))
+
+class __tree_structure__ Node {
+public:
+  __tree_child__ Node *Left = nullptr;
+  __tree_child__ Node *Right = nullptr;
+  int Value = 0;
+  int Visits = 0;
+
+  __tree_traversal__ void setValue(int NewValue) {
+    Value = NewValue;
+    if (Left != nullptr)
+      Left->setValue(NewValue);
+    if (Right != nullptr)
+      Right->setValue(NewValue);
+  }
+
+  __tree_traversal__ void countVisits() {
+    Visits = Visits + 1;
+    if (Left != nullptr)
+      Left->countVisits();
+    if (Right != nullptr)
+      Right->countVisits();
+  }
+};
+
+int Global = 1;
+
+class Driver {
+public:
+  int Counter = 1;
+
+  // Counter is this->Counter, incrementing it before the fused call would
+  // change the value seen by setValue
+  void runWithMemberField(Node *Root) {
+    Root->setValue(Counter);
+    Counter++;
+    Root->countVisits();
+  }
+};
+
+// X is written through a pointer to it
+void runWithPointerAlias(Node *Root) {
+  int X = 2;
+  int *P = &X;
+  Root->setValue(X);
+  *P = 5;
+  Root->countVisits();
+  printf("alias: X = %d\n", X);
+}
+
+// the global passed to the first call is written through a pointer
+void runWithPointerToGlobal(Node *Root, int *G) {
+  Root->setValue(Global);
+  *G = 7;
+  Root->countVisits();
+}
+
+// the statement is independent, the calls are fused
+void runWithIndependentStatement(Node *Root) {
+  int Y = 3;
+  Root->setValue(4);
+  Y = Y * 2;
+  Root->countVisits();
+  printf("independent: Y = %d\n", Y);
+}
+
+int main() {
+  Node *Root = new Node();
+  Root->Left = new Node();
+  Root->Right = new Node();
+
+  Driver D;
+  D.runWithMemberField(Root);
+  printf("member field: Value = %d (expected 1)\n", Root->Left->Value);
+
+  runWithPointerAlias(Root);
+  printf("pointer alias: Value = %d (expected 2)\n", Root->Left->Value);
+
+  runWithPointerToGlobal(Root, &Global);
+  printf("pointer to global: Value = %d (expected 1)\n", Root->Left->Value);
+
+  runWithIndependentStatement(Root);
+  printf("independent: Value = %d (expected 4), Visits = %d (expected 4)\n",
+         Root->Left->Value, Root->Left->Visits);
+}
@@ -0,0 +1,12 @@
+#!/bin/bash
+
+# create a direcotry for the fused code and make a copy of the original code
+rm -r FUSED
+mkdir FUSED
+cp  ./UNFUSED/* ./FUSED/
+
+# run grafter on the created copy, only the calls of
+# runWithIndependentStatement are fused
+grafter  -fuse-non-adjacent ./FUSED/main.cpp -- -I/usr/local/bin/../lib/clang/3.8.0/include/ -I/usr/local/include/c++/v1/ -std=c++11
+
+clang-format -i FUSED/main.cpp
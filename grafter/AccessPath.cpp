@@ -391,7 +391,7 @@ bool AccessPath::handleNextExpression(clang::Stmt *NextExpression) {
 
 const FSM &AccessPath::getWriteAutomata() {
   if (WriteAutomata == nullptr) {
-    WriteAutomata = new FSM();
+    WriteAutomata = FSMUtility::createFSM();
     int StateId = WriteAutomata->AddState();
     WriteAutomata->SetStart(StateId /*0*/);
 
@@ -459,7 +459,7 @@ const FSM &AccessPath::getWriteAutomata() {
 
 const FSM &AccessPath::getReadAutomata() {
   if (ReadAutomata == nullptr) {
-    ReadAutomata = new FSM();
+    ReadAutomata = FSMUtility::createFSM();
     int StateId = ReadAutomata->AddState();
     ReadAutomata->SetStart(StateId /*0*/);
 
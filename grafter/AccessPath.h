@@ -15,6 +15,7 @@
 #include "FSMUtility.h"
 #include "LLVMDependencies.h"
 #include "Logger.h"
+#include "MemoryArena.h"
 
 class FunctionAnalyzer;
 class AccessPath;
@@ -25,7 +26,7 @@ struct AccessPathCompare {
 
 typedef std::set<AccessPath *, AccessPathCompare> AccessPathSet;
 
-class AccessPath {
+class AccessPath : public ArenaAllocated {
 private:
   /// Specify if this access path starts with an aliace declaration
   bool FromAliasing = false;
@@ -153,11 +154,8 @@ public:
   const FSM &getWriteAutomata();
 
   ~AccessPath() {
-    if (WriteAutomata)
-      delete WriteAutomata;
-
-    if (ReadAutomata)
-      delete ReadAutomata;
+    FSMUtility::destroyFSM(WriteAutomata);
+    FSMUtility::destroyFSM(ReadAutomata);
   }
 };
 
@@ -0,0 +1,208 @@
+//===--- AccessPathTrie.cpp -----------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+//===----------------------------------------------------------------------===//
+#include "AccessPathTrie.h"
+#include <algorithm>
+#include <map>
+
+#define DEBUG_TYPE "access-path-trie"
+
+std::atomic<unsigned long> AccessPathTrie::TriesBuilt(0);
+std::atomic<unsigned long> AccessPathTrie::NonLinearAutomata(0);
+std::atomic<unsigned long> AccessPathTrie::TrieQueries(0);
+std::atomic<unsigned long> AccessPathTrie::FallbackQueries(0);
+
+/// Return the sorted set of states reachable from the given states through
+/// epsilon transitions
+static std::vector<int> getEpsClosure(const FSM &Automata,
+                                      std::vector<int> States) {
+  std::vector<bool> Visited(Automata.NumStates(), false);
+  std::vector<int> WorkList;
+  for (int State : States) {
+    if (!Visited[State]) {
+      Visited[State] = true;
+      WorkList.push_back(State);
+    }
+  }
+  States.clear();
+  while (!WorkList.empty()) {
+    int State = WorkList.back();
+    WorkList.pop_back();
+    States.push_back(State);
+    for (fst::ArcIterator<FSM> ArcIt(Automata, State); !ArcIt.Done();
+         ArcIt.Next()) {
+      const auto &Arc = ArcIt.Value();
+      if (Arc.ilabel == 0 && !Visited[Arc.nextstate]) {
+        Visited[Arc.nextstate] = true;
+        WorkList.push_back(Arc.nextstate);
+      }
+    }
+  }
+  std::sort(States.begin(), States.end());
+  return States;
+}
+
+/// Return true if the set of states accepts any suffix, that is if it accepts
+/// the empty word and one of its states loops on the wildcard
+static bool acceptsAnySuffix(const FSM &Automata,
+                             const std::vector<int> &States) {
+  auto isFinal = [&](int State) {
+    return Automata.Final(State) != FSM::Weight::Zero();
+  };
+  if (!std::any_of(States.begin(), States.end(), isFinal))
+    return false;
+
+  int AnyLabel = FSMUtility::getAnyLabel();
+  for (int State : States) {
+    for (fst::ArcIterator<FSM> ArcIt(Automata, State); !ArcIt.Done();
+         ArcIt.Next()) {
+      const auto &Arc = ArcIt.Value();
+      if (Arc.ilabel != AnyLabel)
+        continue;
+      auto Closure = getEpsClosure(Automata, {Arc.nextstate});
+      bool LoopsBack =
+          std::binary_search(Closure.begin(), Closure.end(), State);
+      if (LoopsBack && std::any_of(Closure.begin(), Closure.end(), isFinal))
+        return true;
+    }
+  }
+  return false;
+}
+
+AccessPathTrie *AccessPathTrie::build(const FSM &Automata) {
+  auto *Trie = new AccessPathTrie();
+  if (Automata.Start() == fst::kNoStateId) {
+    Trie->Nodes.emplace_back();
+    TriesBuilt++;
+    return Trie;
+  }
+
+  std::vector<std::vector<int>> Path;
+  if (Trie->buildNode(Automata, getEpsClosure(Automata, {Automata.Start()}),
+                      Path) == -1) {
+    NonLinearAutomata++;
+    delete Trie;
+    return nullptr;
+  }
+  TriesBuilt++;
+  return Trie;
+}
+
+int AccessPathTrie::buildNode(const FSM &Automata,
+                              const std::vector<int> &States,
+                              std::vector<std::vector<int>> &Path) {
+  // reaching the same states again means a cycle on specific labels
+  if (Nodes.size() >= MaxNodes ||
+      std::find(Path.begin(), Path.end(), States) != Path.end())
+    return -1;
+
+  int Node = Nodes.size();
+  Nodes.emplace_back();
+
+  bool Final = false;
+  for (int State : States)
+    Final |= Automata.Final(State) != FSM::Weight::Zero();
+  Nodes[Node].Final = Final;
+
+  // A wildcard arc to states that accept any suffix makes the node accept any
+  // non empty suffix, the other arcs are then subsumed
+  int AnyLabel = FSMUtility::getAnyLabel();
+  for (int State : States) {
+    for (fst::ArcIterator<FSM> ArcIt(Automata, State); !ArcIt.Done();
+         ArcIt.Next()) {
+      const auto &Arc = ArcIt.Value();
+      if (Arc.ilabel == AnyLabel &&
+          acceptsAnySuffix(Automata,
+                           getEpsClosure(Automata, {Arc.nextstate}))) {
+        Nodes[Node].AnySuffix = true;
+        Nodes[Node].AcceptsNonEmpty = true;
+        return Node;
+      }
+    }
+  }
+
+  std::map<int, std::vector<int>> Successors;
+  for (int State : States) {
+    for (fst::ArcIterator<FSM> ArcIt(Automata, State); !ArcIt.Done();
+         ArcIt.Next()) {
+      const auto &Arc = ArcIt.Value();
+      if (Arc.ilabel == 0)
+        continue;
+      // a wildcard that is not a suffix is not linear
+      if (Arc.ilabel == AnyLabel)
+        return -1;
+      Successors[Arc.ilabel].push_back(Arc.nextstate);
+    }
+  }
+
+  Path.push_back(States);
+  std::vector<std::pair<int, int>> Children;
+  bool AcceptsNonEmpty = false;
+  for (auto &Entry : Successors) {
+    int Child = buildNode(Automata, getEpsClosure(Automata, Entry.second),
+                          Path);
+    if (Child == -1)
+      return -1;
+
+    // children that do not accept any path are dropped
+    if (!Nodes[Child].Final && !Nodes[Child].AcceptsNonEmpty)
+      continue;
+    AcceptsNonEmpty = true;
+    Children.push_back(std::make_pair(Entry.first, Child));
+  }
+  Path.pop_back();
+
+  Nodes[Node].Children = std::move(Children);
+  Nodes[Node].AcceptsNonEmpty = AcceptsNonEmpty;
+  return Node;
+}
+
+bool AccessPathTrie::intersectNodes(const AccessPathTrie &Trie1, int Node1,
+                                    const AccessPathTrie &Trie2, int Node2) {
+  const TrieNode &N1 = Trie1.Nodes[Node1];
+  const TrieNode &N2 = Trie2.Nodes[Node2];
+
+  if (N1.Final && N2.Final)
+    return true;
+
+  if ((N1.AnySuffix && N2.AcceptsNonEmpty) ||
+      (N2.AnySuffix && N1.AcceptsNonEmpty))
+    return true;
+
+  // walk the children with a common label
+  auto It1 = N1.Children.begin(), It2 = N2.Children.begin();
+  while (It1 != N1.Children.end() && It2 != N2.Children.end()) {
+    if (It1->first < It2->first) {
+      It1++;
+    } else if (It2->first < It1->first) {
+      It2++;
+    } else {
+      if (intersectNodes(Trie1, It1->second, Trie2, It2->second))
+        return true;
+      It1++;
+      It2++;
+    }
+  }
+  return false;
+}
+
+bool AccessPathTrie::hasNonEmptyIntersection(const AccessPathTrie &Trie1,
+                                             const AccessPathTrie &Trie2) {
+  TrieQueries++;
+  return intersectNodes(Trie1, 0, Trie2, 0);
+}
+
+void AccessPathTrie::printStatistics(llvm::raw_ostream &OS) {
+  unsigned long Trie = TrieQueries, Fallback = FallbackQueries;
+  OS << "INFO: access path tries: " << TriesBuilt << " tries, "
+     << NonLinearAutomata << " non linear automata, " << Trie
+     << " queries answered by tries and " << Fallback
+     << " by automata\n";
+}
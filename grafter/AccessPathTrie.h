@@ -0,0 +1,83 @@
+//===--- AccessPathTrie.h -------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// A prefix trie representation of the access sets of a statement, used by the
+// trie dependence engine (-dep-engine=trie). Most access automata are unions
+// of linear access paths (root.child.child.field) that may end with any
+// suffix, such languages are stored as a trie whose nodes can be marked to
+// accept any non empty suffix. Two tries conflict if a simultaneous walk
+// reaches two accepting nodes.
+//
+// Automata with cycles on specific labels (the accesses of recursive calls)
+// are not linear, the engine falls back to the automata for them.
+//===----------------------------------------------------------------------===//
+
+#ifndef TREE_FUSER_ACCESS_PATH_TRIE
+#define TREE_FUSER_ACCESS_PATH_TRIE
+
+#include "FSMUtility.h"
+#include <atomic>
+#include <utility>
+#include <vector>
+
+class AccessPathTrie {
+private:
+  struct TrieNode {
+    /// The path from the root to the node is accepted
+    bool Final = false;
+
+    /// Any non empty suffix of the path is accepted, such nodes have no
+    /// children
+    bool AnySuffix = false;
+
+    /// Some non empty suffix of the path is accepted
+    bool AcceptsNonEmpty = false;
+
+    /// (label, node index) sorted by label
+    std::vector<std::pair<int, int>> Children;
+  };
+
+  /// Nodes of the trie, the root is the first node
+  std::vector<TrieNode> Nodes;
+
+  /// Automata whose tries would exceed this number of nodes are not converted
+  static const unsigned MaxNodes = 1024;
+
+  static std::atomic<unsigned long> TriesBuilt;
+  static std::atomic<unsigned long> NonLinearAutomata;
+  static std::atomic<unsigned long> TrieQueries;
+  static std::atomic<unsigned long> FallbackQueries;
+
+  /// Add the node reached by the given set of states and return its index,
+  /// return -1 if the language is not linear
+  int buildNode(const FSM &Automata, const std::vector<int> &States,
+                std::vector<std::vector<int>> &Path);
+
+  /// Return true if the tries accept a common suffix from the given nodes
+  static bool intersectNodes(const AccessPathTrie &Trie1, int Node1,
+                             const AccessPathTrie &Trie2, int Node2);
+
+public:
+  /// Return the trie of the language of the automata, or null if the language
+  /// is not linear
+  static AccessPathTrie *build(const FSM &Automata);
+
+  /// Check if the two tries accept a common access path
+  static bool hasNonEmptyIntersection(const AccessPathTrie &Trie1,
+                                      const AccessPathTrie &Trie2);
+
+  /// Record a query answered by the automata instead
+  static void countFallbackQuery() { FallbackQueries++; }
+
+  unsigned getNodesCount() const { return Nodes.size(); }
+
+  /// Print the number of tries and of the queries answered with them
+  static void printStatistics(llvm::raw_ostream &OS);
+};
+
+#endif
@@ -10,6 +10,9 @@
 //===----------------------------------------------------------------------===//
 
 #include "DependenceAnalyzer.h"
+#include "RunStatistics.h"
+#include "llvm/Support/ThreadPool.h"
+#include <functional>
 
 // TODO change this to input configuration
 #define ENABLE_CODE_MOTION 1
@@ -20,6 +23,28 @@ namespace opts {
 llvm::cl::opt<bool> PrintAutomata("dump-automata", cl::desc("print automata"),
                                   cl::init(false), cl::Optional,
                                   cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<unsigned>
+    Threads("j",
+            cl::desc("number of threads used to build the dependence graphs "
+                     "(or to process the translation units with -parallel-tu)"),
+            cl::init(1), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<DependenceEngine> DepEngine(
+    "dep-engine", cl::desc("the representation used to check conflicts"),
+    cl::values(clEnumValN(DE_FST, "fst", "intersect the access automata"),
+               clEnumValN(DE_Trie, "trie",
+                          "walk prefix tries of the access paths, fall back "
+                          "to the automata for non linear accesses")),
+    cl::init(DE_FST), cl::Optional, cl::cat(TreeFuserCategory));
+
+extern llvm::cl::opt<bool> ParallelTranslationUnits;
+} // namespace opts
+
+/// Return the thread pool that runs the dependence analysis tasks
+static llvm::ThreadPool &getAnalysisThreadPool() {
+  static llvm::ThreadPool Pool(opts::Threads);
+  return Pool;
 }
 
 DependenceGraph *DependenceAnalyzer::createDependenceGraph(
@@ -51,32 +76,113 @@ DependenceGraph *DependenceAnalyzer::createDependenceGraph(
     const std::vector<FunctionAnalyzer *> &Traversals) {
 
   // Lookup graph nodes using traversal index and StatementInfo*
-  std::unordered_map<int, std::unordered_map<StatementInfo *, DG_Node *>>
-      GraphNodeLookup;
+  std::vector<GraphNodesMap> GraphNodeLookup(Traversals.size());
 
   DependenceGraph *DepGraph = new DependenceGraph();
   for (int i = 0; i < Traversals.size(); i++) {
+    DepGraph->addTraversal(Traversals[i]->getFunctionDecl());
     for (auto *Stmt : Traversals[i]->getStatements()) {
       auto Pair = make_pair(Stmt, i);
       GraphNodeLookup[i][Stmt] = DepGraph->createNode(Pair);
     }
   }
 
+  // One dependence list per task, the intra-traversal tasks come first
+  // followed by the (i, j) pairs in order
+  std::vector<std::function<void(DependenceList &)>> Tasks;
   for (int i = 0; i < Traversals.size(); i++) {
-    addIntraTraversalDependecies(DepGraph, Traversals[i], GraphNodeLookup[i]);
+    Tasks.push_back([&, i](DependenceList &Dependences) {
+      addIntraTraversalDependecies(Dependences, Traversals[i],
+                                   GraphNodeLookup[i]);
+    });
   }
   for (int i = 0; i < Traversals.size(); i++) {
     for (int j = i + 1; j < Traversals.size(); j++)
-      addInterTraversalDependecies(DepGraph, Traversals[i], Traversals[j],
-                                   GraphNodeLookup[i], GraphNodeLookup[j]);
+      Tasks.push_back([&, i, j](DependenceList &Dependences) {
+        addInterTraversalDependecies(Dependences, Traversals[i], Traversals[j],
+                                     GraphNodeLookup[i], GraphNodeLookup[j]);
+      });
+  }
+  std::vector<DependenceList> Results(Tasks.size());
+
+  // printing automata writes to shared temporary files, when the translation
+  // units are processed concurrently the workers are already busy and waiting
+  // on the pool from one of them would deadlock
+  if (opts::Threads > 1 && !opts::PrintAutomata &&
+      !opts::ParallelTranslationUnits) {
+    buildStatementsAutomata(Traversals);
+    auto &Pool = getAnalysisThreadPool();
+    // the work of the helpers is counted for the thread of the candidate
+    std::vector<CounterSet> TasksWork(Tasks.size());
+    for (int i = 0; i < Tasks.size(); i++)
+      Pool.async([&, i]() {
+        CounterSet Start = RunStatistics::beginThreadWork();
+        Tasks[i](Results[i]);
+        TasksWork[i] = RunStatistics::endThreadWork(Start);
+      });
+    Pool.wait();
+    for (auto &Work : TasksWork)
+      RunStatistics::addThreadWork(Work);
+  } else {
+    for (int i = 0; i < Tasks.size(); i++)
+      Tasks[i](Results[i]);
   }
 
+  // Add the dependences in the same order as the serial analysis
+  for (auto &Dependences : Results)
+    for (auto &Dependence : Dependences)
+      DepGraph->addDependency(Dependence.Type, Dependence.Src,
+                              Dependence.Dest);
+
   return DepGraph;
 }
 
+void DependenceAnalyzer::buildStatementsAutomata(
+    const vector<FunctionAnalyzer *> &Traversals) {
+  for (auto *Traversal : Traversals) {
+    for (auto *Stmt : Traversal->getStatements()) {
+      Stmt->getLocalWritesAutomata();
+      Stmt->getLocalReadsAutomata();
+      Stmt->getGlobWritesAutomata();
+      Stmt->getGlobReadsAutomata();
+      Stmt->getTreeReadsAutomata();
+      Stmt->getTreeWritesAutomata();
+      for (int Set = 0; Set < ACCESS_SETS_COUNT; Set++) {
+        Stmt->getAccessSetHash((ACCESS_SET)Set);
+        if (opts::DepEngine == DE_Trie)
+          Stmt->getAccessSetTrie((ACCESS_SET)Set);
+      }
+    }
+  }
+}
+
+bool DependenceAnalyzer::mayConflict(StatementInfo *Stmt1, ACCESS_SET Set1,
+                                     StatementInfo *Stmt2, ACCESS_SET Set2) {
+  if (opts::DepEngine == DE_Trie) {
+    auto *Trie1 = Stmt1->getAccessSetTrie(Set1);
+    auto *Trie2 = Stmt2->getAccessSetTrie(Set2);
+    if (Trie1 && Trie2)
+      return AccessPathTrie::hasNonEmptyIntersection(*Trie1, *Trie2);
+    AccessPathTrie::countFallbackQuery();
+  }
+  return FSMUtility::hasNonEmptyIntersection(
+      Stmt1->getAccessSetAutomata(Set1), Stmt1->getAccessSetHash(Set1),
+      Stmt2->getAccessSetAutomata(Set2), Stmt2->getAccessSetHash(Set2));
+}
+
+bool DependenceAnalyzer::isEmptySet(StatementInfo *Stmt, ACCESS_SET Set) {
+  return FSMUtility::isEmpty(Stmt->getAccessSetAutomata(Set),
+                             Stmt->getAccessSetHash(Set));
+}
+
 void DependenceAnalyzer::addIntraTraversalDependecies(
-    DependenceGraph *DepGraph, FunctionAnalyzer *Traversal,
-    unordered_map<StatementInfo *, DG_Node *> &GraphNodes) {
+    DependenceList &Dependences, FunctionAnalyzer *Traversal,
+    const GraphNodesMap &GraphNodes) {
+
+  auto addDependency = [&](DEPENDENCE_TYPE Type, StatementInfo *Src,
+                           StatementInfo *Dest) {
+    Dependences.push_back({Type, GraphNodes.at(Src), GraphNodes.at(Dest)});
+  };
 
   for (int i = 0; i < Traversal->getStatements().size(); i++) {
     auto *Stmt1 = Traversal->getStatements()[i];
@@ -87,82 +193,67 @@ void DependenceAnalyzer::addIntraTraversalDependecies(
       assert(Stmt2->getStatementId() == j);
 
       if (!ENABLE_CODE_MOTION)
-        DepGraph->addDependency(CONTROL_DEP, GraphNodes[Stmt1],
-                                GraphNodes[Stmt2]);
+        addDependency(CONTROL_DEP, Stmt1, Stmt2);
 
       // Add control dependences
-      if (Stmt1->hasReturn() &&
-          !FSMUtility::isEmpty(Stmt2->getTreeReadsAutomata()))
-        DepGraph->addDependency(CONTROL_DEP, GraphNodes[Stmt1],
-                                GraphNodes[Stmt2]);
+      if (Stmt1->hasReturn() && !isEmptySet(Stmt2, TREE_READS))
+        addDependency(CONTROL_DEP, Stmt1, Stmt2);
 
       if (Stmt1->hasReturn())
-        if (!FSMUtility::isEmpty(Stmt2->getTreeWritesAutomata()) ||
-            !FSMUtility::isEmpty(Stmt2->getLocalWritesAutomata()) ||
-            !FSMUtility::isEmpty(Stmt2->getGlobWritesAutomata()))
-          DepGraph->addDependency(CONTROL_DEP, GraphNodes[Stmt1],
-                                  GraphNodes[Stmt2]);
+        if (!isEmptySet(Stmt2, TREE_WRITES) ||
+            !isEmptySet(Stmt2, LOCAL_WRITES) ||
+            !isEmptySet(Stmt2, GLOBAL_WRITES))
+          addDependency(CONTROL_DEP, Stmt1, Stmt2);
 
       if (Stmt2->hasReturn())
-        if (!FSMUtility::isEmpty(Stmt1->getTreeWritesAutomata()) ||
-            !FSMUtility::isEmpty(Stmt1->getLocalWritesAutomata()) ||
-            !FSMUtility::isEmpty(Stmt1->getGlobWritesAutomata()))
-          DepGraph->addDependency(CONTROL_DEP, GraphNodes[Stmt1],
-                                  GraphNodes[Stmt2]);
+        if (!isEmptySet(Stmt1, TREE_WRITES) ||
+            !isEmptySet(Stmt1, LOCAL_WRITES) ||
+            !isEmptySet(Stmt1, GLOBAL_WRITES))
+          addDependency(CONTROL_DEP, Stmt1, Stmt2);
 
       // Add data dependences
 
       // Check Global conflicts
-      if (FSMUtility::hasNonEmptyIntersection(Stmt1->getGlobWritesAutomata(),
-                                              Stmt2->getGlobWritesAutomata()) ||
+      if (mayConflict(Stmt1, GLOBAL_WRITES, Stmt2, GLOBAL_WRITES) ||
 
-          FSMUtility::hasNonEmptyIntersection(Stmt1->getGlobWritesAutomata(),
-                                              Stmt2->getGlobReadsAutomata()) ||
+          mayConflict(Stmt1, GLOBAL_WRITES, Stmt2, GLOBAL_READS) ||
 
-          FSMUtility::hasNonEmptyIntersection(Stmt1->getGlobReadsAutomata(),
-                                              Stmt2->getGlobWritesAutomata())) {
+          mayConflict(Stmt1, GLOBAL_READS, Stmt2, GLOBAL_WRITES)) {
 
-        DepGraph->addDependency(GLOBAL_DEP, GraphNodes[Stmt1],
-                                GraphNodes[Stmt2]);
+        addDependency(GLOBAL_DEP, Stmt1, Stmt2);
       }
 
       // Check OnTree conflicts
-      if (FSMUtility::hasNonEmptyIntersection(Stmt1->getTreeWritesAutomata(),
-                                              Stmt2->getTreeWritesAutomata()) ||
+      if (mayConflict(Stmt1, TREE_WRITES, Stmt2, TREE_WRITES) ||
 
-          FSMUtility::hasNonEmptyIntersection(Stmt1->getTreeWritesAutomata(),
-                                              Stmt2->getTreeReadsAutomata()) ||
+          mayConflict(Stmt1, TREE_WRITES, Stmt2, TREE_READS) ||
 
-          FSMUtility::hasNonEmptyIntersection(Stmt1->getTreeReadsAutomata(),
-                                              Stmt2->getTreeWritesAutomata())) {
+          mayConflict(Stmt1, TREE_READS, Stmt2, TREE_WRITES)) {
 
-        DepGraph->addDependency(ONTREE_DEP, GraphNodes[Stmt1],
-                                GraphNodes[Stmt2]);
+        addDependency(ONTREE_DEP, Stmt1, Stmt2);
       }
 
       //  Check local conflicts
-      if (FSMUtility::hasNonEmptyIntersection(
-              Stmt1->getLocalWritesAutomata(),
-              Stmt2->getLocalWritesAutomata()) ||
-
-          FSMUtility::hasNonEmptyIntersection(Stmt1->getLocalWritesAutomata(),
-                                              Stmt2->getLocalReadsAutomata()) ||
-          FSMUtility::hasNonEmptyIntersection(
-              Stmt1->getLocalReadsAutomata(),
-              Stmt2->getLocalWritesAutomata())) {
-
-        DepGraph->addDependency(LOCAL_DEP, GraphNodes[Stmt1],
-                                GraphNodes[Stmt2]);
+      if (mayConflict(Stmt1, LOCAL_WRITES, Stmt2, LOCAL_WRITES) ||
+
+          mayConflict(Stmt1, LOCAL_WRITES, Stmt2, LOCAL_READS) ||
+          mayConflict(Stmt1, LOCAL_READS, Stmt2, LOCAL_WRITES)) {
+
+        addDependency(LOCAL_DEP, Stmt1, Stmt2);
       }
     }
   }
 }
 
 void DependenceAnalyzer::addInterTraversalDependecies(
-    DependenceGraph *DepGraph, FunctionAnalyzer *Traversal1,
-    FunctionAnalyzer *Traversal2,
-    unordered_map<StatementInfo *, DG_Node *> &GraphNodesT1,
-    unordered_map<StatementInfo *, DG_Node *> &GraphNodesT2) {
+    DependenceList &Dependences, FunctionAnalyzer *Traversal1,
+    FunctionAnalyzer *Traversal2, const GraphNodesMap &GraphNodesT1,
+    const GraphNodesMap &GraphNodesT2) {
+
+  auto addDependency = [&](DEPENDENCE_TYPE Type, StatementInfo *Src,
+                           StatementInfo *Dest) {
+    Dependences.push_back({Type, GraphNodesT1.at(Src), GraphNodesT2.at(Dest)});
+  };
 
   for (auto *Stmt1 : Traversal1->getStatements()) {
 
@@ -180,31 +271,23 @@ void DependenceAnalyzer::addInterTraversalDependecies(
     for (auto *Stmt2 : Traversal2->getStatements()) {
 
       // Check Global conflicts
-      if (FSMUtility::hasNonEmptyIntersection(Stmt1->getGlobWritesAutomata(),
-                                              Stmt2->getGlobWritesAutomata()) ||
+      if (mayConflict(Stmt1, GLOBAL_WRITES, Stmt2, GLOBAL_WRITES) ||
 
-          FSMUtility::hasNonEmptyIntersection(Stmt1->getGlobWritesAutomata(),
-                                              Stmt2->getGlobReadsAutomata()) ||
+          mayConflict(Stmt1, GLOBAL_WRITES, Stmt2, GLOBAL_READS) ||
 
-          FSMUtility::hasNonEmptyIntersection(Stmt1->getGlobReadsAutomata(),
-                                              Stmt2->getGlobWritesAutomata())) {
+          mayConflict(Stmt1, GLOBAL_READS, Stmt2, GLOBAL_WRITES)) {
 
-        DepGraph->addDependency(GLOBAL_DEP, GraphNodesT1[Stmt1],
-                                GraphNodesT2[Stmt2]);
+        addDependency(GLOBAL_DEP, Stmt1, Stmt2);
       }
 
       // Check OnTree conflicts
-      if (FSMUtility::hasNonEmptyIntersection(Stmt1->getTreeWritesAutomata(),
-                                              Stmt2->getTreeWritesAutomata()) ||
+      if (mayConflict(Stmt1, TREE_WRITES, Stmt2, TREE_WRITES) ||
 
-          FSMUtility::hasNonEmptyIntersection(Stmt1->getTreeWritesAutomata(),
-                                              Stmt2->getTreeReadsAutomata()) ||
+          mayConflict(Stmt1, TREE_WRITES, Stmt2, TREE_READS) ||
 
-          FSMUtility::hasNonEmptyIntersection(Stmt1->getTreeReadsAutomata(),
-                                              Stmt2->getTreeWritesAutomata())) {
+          mayConflict(Stmt1, TREE_READS, Stmt2, TREE_WRITES)) {
 
-        DepGraph->addDependency(ONTREE_DEP, GraphNodesT1[Stmt1],
-                                GraphNodesT2[Stmt2]);
+        addDependency(ONTREE_DEP, Stmt1, Stmt2);
       }
     }
   }
@@ -19,6 +19,21 @@
 #include "FunctionAnalyzer.h"
 #include <stdio.h>
 
+/// A dependence found between two statements, the analysis tasks collect
+/// them and they are added to the graph once all tasks are done
+struct PendingDependence {
+  DEPENDENCE_TYPE Type;
+  DG_Node *Src;
+  DG_Node *Dest;
+};
+
+typedef std::vector<PendingDependence> DependenceList;
+
+typedef std::unordered_map<StatementInfo *, DG_Node *> GraphNodesMap;
+
+/// The representation used to check conflicts between access sets
+enum DependenceEngine { DE_FST, DE_Trie };
+
 class DependenceAnalyzer {
 
 public:
@@ -30,16 +45,28 @@ private:
   DependenceGraph *
   createDependenceGraph(const vector<FunctionAnalyzer *> &Traversals);
 
-  /// Analyze and add dependences between nodes within the same traversal
-  void addIntraTraversalDependecies(
-      DependenceGraph *Graph, FunctionAnalyzer *Traversal,
-      unordered_map<StatementInfo *, DG_Node *> &StmtToGraphNode);
-
-  /// Analyze and add dependences between nodes from different traversal
-  void addInterTraversalDependecies(
-      DependenceGraph *Graph, FunctionAnalyzer *Traversal1,
-      FunctionAnalyzer *Traversal2,
-      unordered_map<StatementInfo *, DG_Node *> &StmtToGNodeT1,
-      unordered_map<StatementInfo *, DG_Node *> &StmtToGNodeT2);
+  /// Build all the (lazily constructed) automata of the statements of the
+  /// traversals so that the analysis tasks only read them
+  void buildStatementsAutomata(const vector<FunctionAnalyzer *> &Traversals);
+
+  /// Return true if the access sets of the two statements may access the same
+  /// location
+  bool mayConflict(StatementInfo *Stmt1, ACCESS_SET Set1,
+                   StatementInfo *Stmt2, ACCESS_SET Set2);
+
+  /// Return true if the access set of the statement is empty
+  bool isEmptySet(StatementInfo *Stmt, ACCESS_SET Set);
+
+  /// Analyze dependences between nodes within the same traversal
+  void addIntraTraversalDependecies(DependenceList &Dependences,
+                                    FunctionAnalyzer *Traversal,
+                                    const GraphNodesMap &StmtToGraphNode);
+
+  /// Analyze dependences between nodes from different traversal
+  void addInterTraversalDependecies(DependenceList &Dependences,
+                                    FunctionAnalyzer *Traversal1,
+                                    FunctionAnalyzer *Traversal2,
+                                    const GraphNodesMap &StmtToGNodeT1,
+                                    const GraphNodesMap &StmtToGNodeT2);
 };
 #endif /* DependenceAnalyzer_hpp */
@@ -10,7 +10,22 @@
 //===----------------------------------------------------------------------===//
 
 #include "DependenceGraph.h"
-#include <stack>
+#include "RunStatistics.h"
+#include <algorithm>
+
+/// Merged nodes are treated as a single node, identified by their MergeInfo
+static const void *getGroupKey(DG_Node *Node) {
+  if (Node->isMerged())
+    return Node->getMergeInfo();
+  return Node;
+}
+
+static std::vector<DG_Node *> getGroupMembers(DG_Node *Node) {
+  if (!Node->isMerged())
+    return {Node};
+  return std::vector<DG_Node *>(Node->getMergeInfo()->MergedNodes.begin(),
+                                Node->getMergeInfo()->MergedNodes.end());
+}
 
 std::vector<DG_Node *> MergeInfo::getCallsOrdered() {
   vector<DG_Node *> Res;
@@ -27,29 +42,24 @@ std::vector<DG_Node *> MergeInfo::getCallsOrdered() {
   return Res;
 };
 
-bool DG_Node::allPredesVisited(
-    std::unordered_map<DG_Node *, bool> &VisitedNodes) {
+bool DG_Node::allPredesVisited(const llvm::BitVector &VisitedNodes) {
   if (!isMerged()) {
-    for (auto &Dependency : getPredecessors()) {
-      if (!VisitedNodes[Dependency.first])
-        return false;
-    }
-    return true;
+    llvm::BitVector Pending = PredecessorBits;
+    Pending.reset(VisitedNodes);
+    return Pending.none();
   }
 
-  // Handle Merged Nodes
+  // Handle Merged Nodes, excluding internal dependences between them
+  llvm::BitVector Pending, Members;
   for (auto *MergedNode : Info->MergedNodes) {
-    for (auto &Dependency : MergedNode->getPredecessors()) {
-
-      // Excluded internal dependences between merged Nodes
-      if (Info->isInMergedNodes(Dependency.first))
-        continue;
-
-      if (!VisitedNodes[Dependency.first])
-        return false;
-    }
+    Pending |= MergedNode->PredecessorBits;
+    if (Members.size() <= MergedNode->Index)
+      Members.resize(MergedNode->Index + 1);
+    Members.set(MergedNode->Index);
   }
-  return true;
+  Pending.reset(Members);
+  Pending.reset(VisitedNodes);
+  return Pending.none();
 }
 
 bool DG_Node::isRootNode() {
@@ -63,15 +73,38 @@ bool DG_Node::isRootNode() {
   return true;
 }
 
+MergeInfo *DependenceGraph::createMergeInfo() {
+  if (FreeMergeInfos.empty()) {
+    MemoryStatistics::MergeInfosAllocated++;
+    return new (MergeInfosAllocator.Allocate()) MergeInfo();
+  }
+  MemoryStatistics::MergeInfosReused++;
+  MergeInfo *Info = FreeMergeInfos.back();
+  FreeMergeInfos.pop_back();
+  return Info;
+}
+
+void DependenceGraph::releaseMergeInfo(MergeInfo *Info) {
+  Info->MergedNodes.clear();
+  FreeMergeInfos.push_back(Info);
+}
+
 /// TODO why pir?
 DG_Node *DependenceGraph::createNode(pair<StatementInfo *, int> Value) {
 
-  DG_Node *Node = new DG_Node(Value.first, Value.second);
+  DG_Node *Node =
+      new (NodesAllocator.Allocate()) DG_Node(Value.first, Value.second);
+  MemoryStatistics::GraphNodes++;
+  RunStatistics::count(RC_GraphNodes);
+  Node->Index = Nodes.size();
   Nodes.push_back(Node);
+  ReachabilityValid = false;
   return Node;
 }
 
 void DependenceGraph::merge(DG_Node *Node1, DG_Node *Node2) {
+  ReachabilityValid = false;
+  LastMergeUndo.Valid = false;
   if (Node1->isMerged() && Node2->isMerged()) {
 
     MergeInfo *Tmp = Node2->Info;
@@ -80,7 +113,7 @@ void DependenceGraph::merge(DG_Node *Node1, DG_Node *Node2) {
       Node1->Info->MergedNodes.insert(Node);
       Node->Info = Node1->Info;
     }
-    delete Tmp;
+    releaseMergeInfo(Tmp);
 
   }
 
@@ -95,7 +128,7 @@ void DependenceGraph::merge(DG_Node *Node1, DG_Node *Node2) {
     Node1->IsMerged = true;
 
   } else if (!Node1->isMerged() && !Node2->isMerged()) {
-    MergeInfo *Tmp = new MergeInfo();
+    MergeInfo *Tmp = createMergeInfo();
     Node1->IsMerged = true;
     Node2->IsMerged = true;
 
@@ -107,6 +140,18 @@ void DependenceGraph::merge(DG_Node *Node1, DG_Node *Node2) {
 }
 
 void DependenceGraph::unmerge(DG_Node *Node) {
+  RunStatistics::count(RC_Rollbacks);
+  // the reachability can be restored if this undoes the last merge
+  bool RestoreReachability = ReachabilityValid && LastMergeUndo.Valid &&
+                             LastMergeUndo.UnmergedNode == Node;
+  if (RestoreReachability) {
+    for (auto &Entry : LastMergeUndo.OldReachableBits)
+      Entry.first->ReachableBits = std::move(Entry.second);
+  } else {
+    ReachabilityValid = false;
+  }
+  LastMergeUndo.Valid = false;
+
   MergeInfo *NodeMergeInfo = Node->Info;
 
   // unmerge current Node
@@ -118,10 +163,16 @@ void DependenceGraph::unmerge(DG_Node *Node) {
   if (NodeMergeInfo->MergedNodes.size() == 1) {
     (*NodeMergeInfo->MergedNodes.begin())->IsMerged = false;
     (*NodeMergeInfo->MergedNodes.begin())->Info = nullptr;
-    delete NodeMergeInfo;
+    releaseMergeInfo(NodeMergeInfo);
   }
 }
 
+void DependenceGraph::unmergeAll() {
+  for (auto *Node : Nodes)
+    if (Node->isMerged())
+      unmerge(Node);
+}
+
 void DependenceGraph::dump() {
   Logger::getStaticLogger().logDebug("dumping the dependence graph");
   Logger::getStaticLogger().logDebug("dumping Nodes:");
@@ -217,6 +268,14 @@ void DependenceGraph::dumpMergeInfo() {
 void DependenceGraph::addDependency(DEPENDENCE_TYPE DependenceType,
                                     DG_Node *Src, DG_Node *Dest) {
   assert(Src != Dest);
+  ReachabilityValid = false;
+  if (Src->SuccessorBits.size() < Nodes.size())
+    Src->SuccessorBits.resize(Nodes.size());
+  if (Dest->PredecessorBits.size() < Nodes.size())
+    Dest->PredecessorBits.resize(Nodes.size());
+  Src->SuccessorBits.set(Dest->Index);
+  Dest->PredecessorBits.set(Src->Index);
+
   // TODO: add getSuccessorsType function
   if (DependenceType == GLOBAL_DEP) {
     Src->getSuccessors()[Dest].GLOBAL_DEP = true;
@@ -273,106 +332,155 @@ bool DependenceGraph::hasWrongFuse() {
 
 bool DependenceGraph::hasIllegalMerge() { return hasCycle() || hasWrongFuse(); }
 
-bool DependenceGraph::hasCycleRec(DG_Node *Node,
-                                  unordered_map<DG_Node *, int> &Visited,
-                                  stack<DG_Node *> &CyclePath) {
-  // All children are visited (black)
-  if (Visited[Node] == 2)
-    return false;
+bool DependenceGraph::hasCycle() {
+  RunStatistics::count(RC_HasCycleCalls);
+  return !computeReachability();
+}
 
-  // Visit still on stack (gray)
-  if (Visited[Node] == 1) {
-    CyclePath.push(Node);
-    return true;
+void DependenceGraph::resizeBits() {
+  for (auto *Node : Nodes) {
+    Node->SuccessorBits.resize(Nodes.size());
+    Node->PredecessorBits.resize(Nodes.size());
+    Node->ReachableBits.resize(Nodes.size());
   }
+}
 
-  CyclePath.push(Node);
+llvm::BitVector DependenceGraph::getGroupBits(DG_Node *Node) {
+  llvm::BitVector Bits(Nodes.size());
+  for (auto *Member : getGroupMembers(Node))
+    Bits.set(Member->Index);
+  return Bits;
+}
 
-  if (!Node->isMerged()) {
-    Visited[Node] = 1;
+llvm::BitVector DependenceGraph::getGroupSuccessorBits(DG_Node *Node) {
+  llvm::BitVector Bits(Nodes.size());
+  for (auto *Member : getGroupMembers(Node))
+    Bits |= Member->SuccessorBits;
+  Bits.reset(getGroupBits(Node));
+  return Bits;
+}
 
-    //  visit successors
-    for (auto &Successor : Node->getSuccessors()) {
-      if (hasCycleRec(Successor.first, Visited, CyclePath))
-        return true;
-    }
+bool DependenceGraph::computeReachability() {
+  resizeBits();
+  LastMergeUndo.Valid = false;
+
+  // Kahn's algorithm on the graph where each merged set is represented by one
+  // of its nodes
+  auto getRepresentative = [](DG_Node *Node) {
+    return Node->isMerged() ? *Node->getMergeInfo()->MergedNodes.begin()
+                            : Node;
+  };
+  std::vector<llvm::BitVector> Successors(Nodes.size());
+  std::vector<unsigned> InDegree(Nodes.size(), 0);
+  std::vector<DG_Node *> Order;
+  unsigned GroupsCount = 0;
+  for (auto *Node : Nodes) {
+    if (getRepresentative(Node) != Node)
+      continue;
+    GroupsCount++;
+    auto SuccessorBits = getGroupSuccessorBits(Node);
+    Successors[Node->Index].resize(Nodes.size());
+    for (int I = SuccessorBits.find_first(); I != -1;
+         I = SuccessorBits.find_next(I))
+      Successors[Node->Index].set(getRepresentative(Nodes[I])->Index);
+  }
+  for (auto &Bits : Successors)
+    for (int I = Bits.find_first(); I != -1; I = Bits.find_next(I))
+      InDegree[I]++;
+  for (auto *Node : Nodes)
+    if (getRepresentative(Node) == Node && InDegree[Node->Index] == 0)
+      Order.push_back(Node);
+  for (unsigned i = 0; i < Order.size(); i++) {
+    auto &Bits = Successors[Order[i]->Index];
+    for (int I = Bits.find_first(); I != -1; I = Bits.find_next(I))
+      if (--InDegree[I] == 0)
+        Order.push_back(Nodes[I]);
+  }
 
-    Visited[Node] = 2;
-    CyclePath.pop();
+  ReachabilityValid = Order.size() == GroupsCount;
+  if (!ReachabilityValid)
     return false;
+
+  // the closure of a set is the union of the closures of its successors
+  for (auto It = Order.rbegin(); It != Order.rend(); It++) {
+    auto *Node = *It;
+    llvm::BitVector Reachable(Nodes.size());
+    auto &Bits = Successors[Node->Index];
+    for (int I = Bits.find_first(); I != -1; I = Bits.find_next(I)) {
+      Reachable |= getGroupBits(Nodes[I]);
+      Reachable |= Nodes[I]->ReachableBits;
+    }
+    for (auto *Member : getGroupMembers(Node))
+      Member->ReachableBits = Reachable;
   }
+  return true;
+}
 
-  // Handle merged nodes
-  MergeInfo *NodeMergeInfo = Node->Info;
+bool DependenceGraph::reachesIndirectly(DG_Node *From,
+                                        const llvm::BitVector &FromBits,
+                                        const llvm::BitVector &ToBits) {
+  // direct dependences become internal to the merged node
+  auto Successors = getGroupSuccessorBits(From);
+  Successors.reset(ToBits);
+  for (int I = Successors.find_first(); I != -1;
+       I = Successors.find_next(I))
+    if (Nodes[I]->ReachableBits.anyCommon(ToBits))
+      return true;
+  return false;
+}
 
-  for (auto *MergedNode : NodeMergeInfo->MergedNodes) {
-    assert(!Visited[MergedNode]);
-    Visited[MergedNode] = 1;
-  }
+bool DependenceGraph::tryMerge(DG_Node *Node1, DG_Node *Node2) {
+  if (getGroupKey(Node1) == getGroupKey(Node2))
+    return true;
 
-  // Visit all successors
-  for (auto *MergedNode : NodeMergeInfo->MergedNodes) {
-    for (auto &Successor : MergedNode->getSuccessors()) {
-      if (NodeMergeInfo->isInMergedNodes(Successor.first))
-        continue;
-      else {
-        if (hasCycleRec(Successor.first, Visited, CyclePath))
-          return true;
-      }
-    }
+  RunStatistics::count(RC_MergeAttempts);
+  if (!ReachabilityValid && !computeReachability()) {
+    RunStatistics::count(RC_MergeRejections);
+    return false;
   }
 
-  // Finalize colors
-  for (auto *MergedNode : NodeMergeInfo->MergedNodes) {
-    assert(Visited[MergedNode] == 1);
-    Visited[MergedNode] = 2;
+  auto Bits1 = getGroupBits(Node1);
+  auto Bits2 = getGroupBits(Node2);
+  if (reachesIndirectly(Node1, Bits1, Bits2) ||
+      reachesIndirectly(Node2, Bits2, Bits1)) {
+    RunStatistics::count(RC_MergeRejections);
+    return false;
   }
-  CyclePath.pop();
-  return false;
-}
 
-void DependenceGraph::printCyclePath(stack<DG_Node *> CyclePath) {
+  // the merge can only be undone by unmerging a node that was not merged
+  MergeUndoInfo Undo;
+  Undo.UnmergedNode =
+      !Node2->isMerged() ? Node2 : (!Node1->isMerged() ? Node1 : nullptr);
+  Undo.Valid = Undo.UnmergedNode != nullptr;
 
-  Logger::getStaticLogger().logDebug("printing cycle info ");
-  while (!CyclePath.empty()) {
-    DG_Node *TopNode = CyclePath.top();
-    CyclePath.pop();
+  llvm::BitVector Merged = Bits1;
+  Merged |= Bits2;
+  llvm::BitVector Reachable = Node1->ReachableBits;
+  Reachable |= Node2->ReachableBits;
+  Reachable.reset(Merged);
 
-    if (TopNode->isMerged()) {
-      Logger::getStaticLogger().logDebug("-merge Node participating Nodes  :");
+  merge(Node1, Node2);
 
-      for (auto *MergedNode : TopNode->Info->MergedNodes) {
-        Logger::getStaticLogger().logDebug(
-            "\tNode :[" + to_string(MergedNode->getTraversalId()) + "|" +
-            to_string(MergedNode->getStatementInfo()->getStatementId()) + "|" +
-            to_string((long long)(MergedNode->getStatementInfo())));
-      }
+  // the nodes that reach one of the sets now reach the merged set and all
+  // that it reaches, the other rows are unchanged
+  for (auto *Node : Nodes) {
+    bool InMerged = Merged.test(Node->Index);
+    if (!InMerged && !Node->ReachableBits.anyCommon(Merged))
+      continue;
+    if (Undo.Valid)
+      Undo.OldReachableBits.push_back(
+          std::make_pair(Node, Node->ReachableBits));
+    if (InMerged) {
+      Node->ReachableBits = Reachable;
     } else {
-      Logger::getStaticLogger().logDebug(
-          "-single Node :[" + to_string((TopNode)->getTraversalId()) + "|" +
-          to_string((TopNode)->getStatementInfo()->getStatementId()) + "|" +
-          to_string((long long)((TopNode)->getStatementInfo())));
-      Logger::getStaticLogger().logDebug(
-          TopNode->getStatementInfo()->Stmt->getStmtClassName());
+      Node->ReachableBits |= Merged;
+      Node->ReachableBits |= Reachable;
     }
   }
-}
 
-bool DependenceGraph::hasCycle() {
-
-  std::unordered_map<DG_Node *, int> Visited;
-  stack<DG_Node *> CyclePath;
-  for (auto Node : Nodes) {
-    // Not  Grey
-    assert(Visited[Node] != 1);
-    if (!Visited[Node]) {
-      if (hasCycleRec(Node, Visited, CyclePath)) {
-        // printCyclePath(CyclePath);
-        return true;
-      }
-    }
-  }
-  return false;
+  ReachabilityValid = true;
+  LastMergeUndo = std::move(Undo);
+  return true;
 }
 
 void DependenceGraph::mergeAllCalls() {
@@ -13,7 +13,9 @@
 #define TREE_FUSER_DEPENDENCE_GRAPH
 
 #include "Logger.h"
+#include "MemoryArena.h"
 #include "StatementInfo.h"
+#include "llvm/ADT/BitVector.h"
 
 #include <stack>
 #include <stdio.h>
@@ -60,6 +62,17 @@ private:
   std::unordered_map<DG_Node *, DependenceInfo> Successors;
   std::unordered_map<DG_Node *, DependenceInfo> Predecessors;
 
+  /// Position of the node in the nodes of the graph
+  unsigned Index;
+
+  /// The indices of the successors and of the predecessors of the node
+  llvm::BitVector SuccessorBits;
+  llvm::BitVector PredecessorBits;
+
+  /// The indices of the nodes reachable from the node (or from its merged
+  /// set, excluding the set), valid when the graph reachability is valid
+  llvm::BitVector ReachableBits;
+
   /// A unique Id associated with each traversal within the dependence graph in
   /// their original order
   int TraversalId;
@@ -96,24 +109,92 @@ public:
 
   int getTraversalId() const { return TraversalId; }
 
+  unsigned getIndex() const { return Index; }
+
   DG_Node(class StatementInfo *StmtInfo_, int TraversalId_) {
     StmtInfo = StmtInfo_;
     TraversalId = TraversalId_;
   }
 
-  bool allPredesVisited(std::unordered_map<DG_Node *, bool> &VisitedNodes);
+  /// Return true if all the predecessors of the node (or of its merged set)
+  /// are in VisitedNodes
+  bool allPredesVisited(const llvm::BitVector &VisitedNodes);
 };
 
 class DependenceGraph {
 private:
-  bool hasCycleRec(DG_Node *Node, std::unordered_map<DG_Node *, int> &Visited,
-                   std::stack<DG_Node *> &CyclePath);
   /// Store all graph nodes
   std::vector<DG_Node *> Nodes;
 
+  /// The nodes and the merge information are owned by the graph and released
+  /// together with it
+  llvm::SpecificBumpPtrAllocator<DG_Node> NodesAllocator;
+  llvm::SpecificBumpPtrAllocator<MergeInfo> MergeInfosAllocator;
+
+  /// Merge information released by unmerges, reused by the next merges
+  std::vector<MergeInfo *> FreeMergeInfos;
+
+  MergeInfo *createMergeInfo();
+
+  void releaseMergeInfo(MergeInfo *Info);
+
+  /// The traversals whose statements are in the graph, indexed by their
+  /// traversal id
+  std::vector<clang::FunctionDecl *> Traversals;
+
+  /// True when the ReachableBits of the nodes are the transitive closure of
+  /// the graph (where merged nodes are contracted into one node)
+  bool ReachabilityValid = false;
+
+  /// Information needed to restore the reachability when the last merge
+  /// performed by tryMerge is undone
+  struct MergeUndoInfo {
+    bool Valid = false;
+    /// The node that was not merged before the merge, unmerging it undoes
+    /// the merge
+    DG_Node *UnmergedNode = nullptr;
+    /// The closure rows changed by the merge, only the merged sets and the
+    /// nodes that reach them are affected
+    std::vector<std::pair<DG_Node *, llvm::BitVector>> OldReachableBits;
+  } LastMergeUndo;
+
+  /// Resize the bit vectors of the nodes to the number of nodes
+  void resizeBits();
+
+  /// Return the indices of the node and of the nodes merged with it
+  llvm::BitVector getGroupBits(DG_Node *Node);
+
+  /// Return the indices of the successors of the node and of the nodes merged
+  /// with it, excluding the merged set
+  llvm::BitVector getGroupSuccessorBits(DG_Node *Node);
+
+  /// Compute the transitive closure from scratch, return false if the graph
+  /// has a cycle
+  bool computeReachability();
+
+  /// Return true if the merged set From reaches the merged set To through
+  /// another node
+  bool reachesIndirectly(DG_Node *From, const llvm::BitVector &FromBits,
+                         const llvm::BitVector &ToBits);
+
 public:
+  DependenceGraph() {
+    MemoryStatistics::GraphsCreated++;
+    MemoryStatistics::GraphsLive++;
+  }
+
+  ~DependenceGraph() { MemoryStatistics::GraphsLive--; }
+
   std::vector<DG_Node *> &getNodes() { return Nodes; }
 
+  const std::vector<clang::FunctionDecl *> &getTraversals() const {
+    return Traversals;
+  }
+
+  void addTraversal(clang::FunctionDecl *Traversal) {
+    Traversals.push_back(Traversal);
+  }
+
   void dump();
 
   void dumpToPrint();
@@ -123,9 +204,17 @@ public:
   /// Merge two nodes in the graph
   void merge(DG_Node *Node1, DG_Node *Node2);
 
+  /// Merge two nodes if the merge keeps the graph acyclic, the test and the
+  /// update of the transitive closure are done on bit vectors. Return false
+  /// and leave the graph unchanged if the merge forms a cycle
+  bool tryMerge(DG_Node *Node1, DG_Node *Node2);
+
   /// Unmerge a node from the set of nodes that its merged with
   void unmerge(DG_Node *Node);
 
+  /// Undo all the merges performed on the graph
+  void unmergeAll();
+
   /// add a dependence between two nodes
   void addDependency(DEPENDENCE_TYPE DepType, DG_Node *Src, DG_Node *Dest);
 
@@ -141,7 +230,5 @@ public:
   bool hasIllegalMerge();
 
   void mergeAllCalls();
-
-  void printCyclePath(stack<DG_Node *> path);
 };
 #endif
@@ -10,13 +10,16 @@
 //===----------------------------------------------------------------------===//
 #include <FSMUtility.h>
 #include <Logger.h>
+#include <RunStatistics.h>
+#include <algorithm>
 #include <cstdlib>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 #define DEBUG_TYPE "fsm-utility"
 
-int FSMUtility::Counter = 2;
+int FSMUtility::Counter = 3;
 
 std::unordered_map<clang::ValueDecl *, int> FSMUtility::SymbolToLabel =
     []() -> std::unordered_map<clang::ValueDecl *, int> {
@@ -40,7 +43,28 @@ std::unordered_map<int, int> FSMUtility::LabelToSymbol_Abst =
 
 FSM *FSMUtility::AnyClosureAutomata = nullptr;
 
+std::unordered_map<FSMUtility::QueryKey, bool, FSMUtility::QueryKeyHasher>
+    FSMUtility::IntersectionCache;
+
+std::unordered_map<FSMUtility::QueryKey, bool, FSMUtility::QueryKeyHasher>
+    FSMUtility::EmptinessCache;
+
+std::atomic<unsigned long> FSMUtility::QueryCacheHits(0);
+
+std::atomic<unsigned long> FSMUtility::QueryCacheMisses(0);
+
+std::atomic<unsigned long> FSMUtility::NormalizedAutomata(0);
+std::atomic<unsigned long> FSMUtility::StatesBeforeNormalize(0);
+std::atomic<unsigned long> FSMUtility::ArcsBeforeNormalize(0);
+std::atomic<unsigned long> FSMUtility::StatesAfterNormalize(0);
+std::atomic<unsigned long> FSMUtility::ArcsAfterNormalize(0);
+
+llvm::sys::SmartRWMutex<true> FSMUtility::SymbolsLock;
+
+llvm::sys::SmartMutex<true> FSMUtility::QueryCacheLock;
+
 void FSMUtility::addSymbol(clang::ValueDecl *ValueDecl) {
+  llvm::sys::SmartScopedWriter<true> Guard(SymbolsLock);
   if (!SymbolToLabel.count(ValueDecl)) {
     LLVM_DEBUG(ValueDecl->dump());
     LLVM_DEBUG(outs() << "mapped to " << Counter);
@@ -51,6 +75,7 @@ void FSMUtility::addSymbol(clang::ValueDecl *ValueDecl) {
 }
 
 void FSMUtility::addSymbol(int AbstractAccessId) {
+  llvm::sys::SmartScopedWriter<true> Guard(SymbolsLock);
   if (!SymbolToLabel_Abst.count(AbstractAccessId)) {
     SymbolToLabel_Abst[AbstractAccessId] = Counter;
     LabelToSymbol_Abst[Counter] = AbstractAccessId;
@@ -58,18 +83,30 @@ void FSMUtility::addSymbol(int AbstractAccessId) {
   }
 }
 
+int FSMUtility::getLabel(clang::ValueDecl *Symbol) {
+  llvm::sys::SmartScopedReader<true> Guard(SymbolsLock);
+  auto It = SymbolToLabel.find(Symbol);
+  assert(It != SymbolToLabel.end());
+  return It->second;
+}
+
+int FSMUtility::getLabel(int AbstractAccessId) {
+  llvm::sys::SmartScopedReader<true> Guard(SymbolsLock);
+  auto It = SymbolToLabel_Abst.find(AbstractAccessId);
+  assert(It != SymbolToLabel_Abst.end());
+  return It->second;
+}
+
 void FSMUtility::addTransition(FSM &Automata, int Src, int Dest,
                                clang::ValueDecl *Access) {
-  assert(SymbolToLabel.count(Access));
-  Automata.AddArc(
-      Src, fst::StdArc(SymbolToLabel[Access], SymbolToLabel[Access], 0, Dest));
+  int Label = getLabel(Access);
+  Automata.AddArc(Src, fst::StdArc(Label, Label, 0, Dest));
 }
 
 void FSMUtility::addTransitionOnAbstractAccess(FSM &Automata, int Src, int Dest,
                                                int Access) {
-  assert(SymbolToLabel_Abst.count(Access));
-  Automata.AddArc(Src, fst::StdArc(SymbolToLabel_Abst[Access],
-                                   SymbolToLabel_Abst[Access], 0, Dest));
+  int Label = getLabel(Access);
+  Automata.AddArc(Src, fst::StdArc(Label, Label, 0, Dest));
 }
 
 void FSMUtility::addTraversedNodeTransition(FSM &Automata, int Src, int Dest) {
@@ -81,36 +118,286 @@ void FSMUtility::addEpsTransition(FSM &Automata, int Src, int Dest) {
 }
 
 void FSMUtility::addAnyTransition(FSM &Automata, int Src, int Dest) {
-  for (int I = 1; I < Counter; I++) {
-    Automata.AddArc(Src, fst::StdArc(I, I, 0, Dest));
+  Automata.AddArc(Src, fst::StdArc(AnyLabel, AnyLabel, 0, Dest));
+}
+
+size_t FSMUtility::getStructuralHash(const FSM &Automata) {
+  size_t Hash = llvm::hash_combine(Automata.NumStates(), Automata.Start());
+  for (fst::StateIterator<FSM> StateIt(Automata); !StateIt.Done();
+       StateIt.Next()) {
+    auto State = StateIt.Value();
+    Hash = llvm::hash_combine(Hash, State,
+                              Automata.Final(State) != FSM::Weight::Zero());
+    for (fst::ArcIterator<FSM> ArcIt(Automata, State); !ArcIt.Done();
+         ArcIt.Next())
+      Hash = llvm::hash_combine(Hash, ArcIt.Value().ilabel,
+                                ArcIt.Value().nextstate);
   }
+  return Hash;
+}
+
+FSMUtility::QueryKey FSMUtility::createQueryKey(const FSM &Automata1,
+                                                size_t Hash1,
+                                                const FSM *Automata2,
+                                                size_t Hash2) {
+  // intersection is commutative, order the operands by address so that
+  // (A, B) and (B, A) share the same entry
+  QueryKey Key{&Automata1, Hash1, Automata2, Hash2};
+  if (Key.Second && std::less<const FSM *>()(Key.Second, Key.First)) {
+    std::swap(Key.First, Key.Second);
+    std::swap(Key.FirstHash, Key.SecondHash);
+  }
+  return Key;
+}
+
+bool FSMUtility::lookupQuery(
+    std::unordered_map<QueryKey, bool, QueryKeyHasher> &Cache,
+    const QueryKey &Key, bool &Result) {
+  llvm::sys::SmartScopedLock<true> Guard(QueryCacheLock);
+  auto It = Cache.find(Key);
+  if (It == Cache.end()) {
+    QueryCacheMisses++;
+    return false;
+  }
+  QueryCacheHits++;
+  Result = It->second;
+  return true;
+}
+
+bool FSMUtility::storeQuery(
+    std::unordered_map<QueryKey, bool, QueryKeyHasher> &Cache,
+    const QueryKey &Key, bool Result) {
+  llvm::sys::SmartScopedLock<true> Guard(QueryCacheLock);
+  Cache[Key] = Result;
+  return Result;
 }
 
 bool FSMUtility::hasNonEmptyIntersection(const FSM &Automata1,
                                          const FSM &Automata2) {
-  FSM Intersection;
-  fst::Intersect(Automata1, Automata2, &Intersection);
-  return !isEmpty(Intersection);
+  return hasNonEmptyIntersection(Automata1, getStructuralHash(Automata1),
+                                 Automata2, getStructuralHash(Automata2));
+}
+
+bool FSMUtility::hasNonEmptyIntersection(const FSM &Automata1, size_t Hash1,
+                                         const FSM &Automata2, size_t Hash2) {
+  RunStatistics::count(RC_IntersectionQueries);
+  QueryKey Key = createQueryKey(Automata1, Hash1, &Automata2, Hash2);
+  bool Result;
+  if (lookupQuery(IntersectionCache, Key, Result))
+    return Result;
+
+  // computed outside the lock, concurrent misses on the same key compute the
+  // same answer
+  return storeQuery(IntersectionCache, Key,
+                    computeHasNonEmptyIntersection(Automata1, Automata2));
 }
 
 bool FSMUtility::isEmpty(const FSM &Automata) {
-  FSM Intersection;
-  fst::Intersect(Automata, Automata, &Intersection);
-  return Intersection.NumStates() == 0;
+  return isEmpty(Automata, getStructuralHash(Automata));
 }
 
-const FSM &FSMUtility::getAnyClosureAutomata() {
-  if (!AnyClosureAutomata) {
-    AnyClosureAutomata = new FSM();
-    int Src = AnyClosureAutomata->AddState();
-    AnyClosureAutomata->SetStart(Src);
+bool FSMUtility::isEmpty(const FSM &Automata, size_t Hash) {
+  QueryKey Key = createQueryKey(Automata, Hash);
+  bool Result;
+  if (lookupQuery(EmptinessCache, Key, Result))
+    return Result;
+  return storeQuery(EmptinessCache, Key, computeIsEmpty(Automata));
+}
+
+bool FSMUtility::computeIsEmpty(const FSM &Automata) {
+  if (Automata.Start() == fst::kNoStateId)
+    return true;
+
+  std::vector<bool> Visited(Automata.NumStates(), false);
+  std::vector<int> WorkList;
+  WorkList.push_back(Automata.Start());
+  Visited[Automata.Start()] = true;
 
-    int Dest = AnyClosureAutomata->AddState();
-    AnyClosureAutomata->SetFinal(Dest, 0);
+  while (!WorkList.empty()) {
+    int State = WorkList.back();
+    WorkList.pop_back();
 
-    FSMUtility::addAnyTransition(*AnyClosureAutomata, Src, Dest);
+    if (Automata.Final(State) != FSM::Weight::Zero())
+      return false;
 
-    fst::Closure(AnyClosureAutomata, fst::CLOSURE_STAR);
+    for (fst::ArcIterator<FSM> ArcIt(Automata, State); !ArcIt.Done();
+         ArcIt.Next()) {
+      int Next = ArcIt.Value().nextstate;
+      if (!Visited[Next]) {
+        Visited[Next] = true;
+        WorkList.push_back(Next);
+      }
+    }
+  }
+  return true;
+}
+
+void FSMUtility::collectArcs(const FSM &Automata, int State,
+                             std::vector<std::pair<int, int>> &LabeledArcs,
+                             std::vector<int> &EpsDestinations,
+                             std::vector<int> &AnyDestinations) {
+  LabeledArcs.clear();
+  EpsDestinations.clear();
+  AnyDestinations.clear();
+  for (fst::ArcIterator<FSM> ArcIt(Automata, State); !ArcIt.Done();
+       ArcIt.Next()) {
+    const auto &Arc = ArcIt.Value();
+    if (Arc.ilabel == 0) {
+      EpsDestinations.push_back(Arc.nextstate);
+      continue;
+    }
+    if (Arc.ilabel == AnyLabel)
+      AnyDestinations.push_back(Arc.nextstate);
+    LabeledArcs.push_back(std::make_pair(Arc.ilabel, Arc.nextstate));
+  }
+  // most automata are already arc-sorted, this is then a linear pass
+  if (!std::is_sorted(LabeledArcs.begin(), LabeledArcs.end()))
+    std::sort(LabeledArcs.begin(), LabeledArcs.end());
+}
+
+bool FSMUtility::computeHasNonEmptyIntersection(const FSM &Automata1,
+                                                const FSM &Automata2) {
+  RunStatistics::count(RC_IntersectionsComputed);
+  RunStatistics::countMax(
+      RC_MaxAutomataStates,
+      std::max(Automata1.NumStates(), Automata2.NumStates()));
+  if (Automata1.Start() == fst::kNoStateId ||
+      Automata2.Start() == fst::kNoStateId)
+    return false;
+
+  // a product state is encoded as (State1 << 32 | State2)
+  auto encode = [](uint64_t State1, uint64_t State2) -> uint64_t {
+    return State1 << 32 | State2;
+  };
+
+  std::unordered_set<uint64_t> Visited;
+  std::vector<std::pair<int, int>> WorkList;
+
+  auto visit = [&](int State1, int State2) {
+    if (Visited.insert(encode(State1, State2)).second)
+      WorkList.push_back(std::make_pair(State1, State2));
+  };
+
+  visit(Automata1.Start(), Automata2.Start());
+
+  std::vector<std::pair<int, int>> Arcs1, Arcs2;
+  std::vector<int> Eps1, Eps2, Any1, Any2;
+
+  while (!WorkList.empty()) {
+    auto Pair = WorkList.back();
+    WorkList.pop_back();
+
+    if (Automata1.Final(Pair.first) != FSM::Weight::Zero() &&
+        Automata2.Final(Pair.second) != FSM::Weight::Zero()) {
+      RunStatistics::count(RC_ProductStates, Visited.size());
+      return true;
+    }
+
+    collectArcs(Automata1, Pair.first, Arcs1, Eps1, Any1);
+    collectArcs(Automata2, Pair.second, Arcs2, Eps2, Any2);
+
+    // epsilon moves are taken independently in each automata
+    for (int Next : Eps1)
+      visit(Next, Pair.second);
+    for (int Next : Eps2)
+      visit(Pair.first, Next);
+
+    // a wildcard arc moves together with every labeled arc of the other
+    // automata (wildcards on both sides are also matched by the join below)
+    for (int Next1 : Any1)
+      for (auto &Arc2 : Arcs2)
+        visit(Next1, Arc2.second);
+    for (int Next2 : Any2)
+      for (auto &Arc1 : Arcs1)
+        visit(Arc1.second, Next2);
+
+    // merge join the labeled arcs of the two states
+    auto It1 = Arcs1.begin(), It2 = Arcs2.begin();
+    while (It1 != Arcs1.end() && It2 != Arcs2.end()) {
+      if (It1->first < It2->first) {
+        It1++;
+      } else if (It2->first < It1->first) {
+        It2++;
+      } else {
+        int Label = It1->first;
+        auto End2 = It2;
+        while (End2 != Arcs2.end() && End2->first == Label)
+          End2++;
+        for (; It1 != Arcs1.end() && It1->first == Label; It1++)
+          for (auto It = It2; It != End2; It++)
+            visit(It1->second, It->second);
+        It2 = End2;
+      }
+    }
+  }
+  RunStatistics::count(RC_ProductStates, Visited.size());
+  return false;
+}
+
+void FSMUtility::clearQueryCache() {
+  llvm::sys::SmartScopedLock<true> Guard(QueryCacheLock);
+  IntersectionCache.clear();
+  EmptinessCache.clear();
+}
+
+void FSMUtility::printQueryCacheStatistics(llvm::raw_ostream &OS) {
+  llvm::sys::SmartScopedLock<true> Guard(QueryCacheLock);
+  unsigned long Hits = QueryCacheHits, Misses = QueryCacheMisses;
+  unsigned long Total = Hits + Misses;
+  OS << "INFO: automata query cache: " << Total << " queries, " << Hits
+     << " hits, " << Misses << " misses";
+  if (Total)
+    OS << " (" << (Hits * 100 / Total) << "% hit rate)";
+  OS << ", " << IntersectionCache.size() << " intersection and "
+     << EmptinessCache.size() << " emptiness entries\n";
+}
+
+unsigned long FSMUtility::getArcsCount(const FSM &Automata) {
+  unsigned long Count = 0;
+  for (fst::StateIterator<FSM> StateIt(Automata); !StateIt.Done();
+       StateIt.Next())
+    Count += Automata.NumArcs(StateIt.Value());
+  return Count;
+}
+
+void FSMUtility::normalize(FSM &Automata) {
+  NormalizedAutomata++;
+  StatesBeforeNormalize += Automata.NumStates();
+  ArcsBeforeNormalize += getArcsCount(Automata);
+
+  if (Automata.Start() != fst::kNoStateId) {
+    // the wildcard is an ordinary label for these operations, they keep the
+    // set of label sequences and thus the language it denotes
+    fst::RmEpsilon(&Automata);
+    FSM Deterministic;
+    fst::Determinize(Automata, &Deterministic);
+    fst::Minimize(&Deterministic);
+    Automata = Deterministic;
+  }
+  fst::ArcSort(&Automata, fst::ILabelCompare<fst::StdArc>());
+
+  StatesAfterNormalize += Automata.NumStates();
+  ArcsAfterNormalize += getArcsCount(Automata);
+}
+
+void FSMUtility::printNormalizationStatistics(llvm::raw_ostream &OS) {
+  OS << "INFO: automata normalization: " << NormalizedAutomata
+     << " automata, states " << StatesBeforeNormalize << " -> "
+     << StatesAfterNormalize << ", arcs " << ArcsBeforeNormalize << " -> "
+     << ArcsAfterNormalize << "\n";
+}
+
+const FSM &FSMUtility::getAnyClosureAutomata() {
+  static llvm::sys::SmartMutex<true> AnyClosureLock;
+  llvm::sys::SmartScopedLock<true> Guard(AnyClosureLock);
+  if (!AnyClosureAutomata) {
+    // a single state with a wildcard self loop, it does not depend on the
+    // symbols added so far
+    AnyClosureAutomata = createFSM();
+    int State = AnyClosureAutomata->AddState();
+    AnyClosureAutomata->SetStart(State);
+    AnyClosureAutomata->SetFinal(State, 0);
+    FSMUtility::addAnyTransition(*AnyClosureAutomata, State, State);
   }
 
   return *AnyClosureAutomata;
@@ -118,7 +405,7 @@ const FSM &FSMUtility::getAnyClosureAutomata() {
 
 FSM *FSMUtility::CopyRootRemoved(const FSM &In) {
   // create a copy of the input
-  FSM *Out = new FSM();
+  FSM *Out = createFSM();
   fst::Union(Out, In);
   std::vector<std::pair<int, int>> ReplaceMap;
   // convert transition on root to epsilon transitions
@@ -162,6 +449,7 @@ void FSMUtility::print(const FSM &Automata, std::string FileName,
           .c_str());
 
   // Replace labels with symbols
+  llvm::sys::SmartScopedReader<true> Guard(SymbolsLock);
   for (auto &Entry : LabelToSymbol) {
     if (Entry.second) // avoid when nullptr (thisExpr)
       system((string("sed -i 's/") + std::to_string(Entry.first) + ":" +
@@ -176,6 +464,9 @@ void FSMUtility::print(const FSM &Automata, std::string FileName,
               to_string(Entry.second) + ">" + "/g' " + FileName + ".dot")
                  .c_str());
   }
+  system((string("sed -i 's/") + std::to_string(AnyLabel) + ":" +
+          std::to_string(AnyLabel) + "/*/g' " + FileName + ".dot")
+             .c_str());
   system((string("sed -i 's/") + "1:1" + +"/" + "^root" + "/g' " + FileName +
           ".dot")
              .c_str());
@@ -16,7 +16,12 @@
 #define TREE_FUSER_FINITE_STATE_MACHINE
 
 #include <LLVMDependencies.h>
+#include <MemoryArena.h>
 #include <fst/fstlib.h>
+#include <atomic>
+#include <llvm/ADT/Hashing.h>
+#include <llvm/Support/Mutex.h>
+#include <llvm/Support/RWMutex.h>
 #include <unordered_map>
 
 typedef fst::StdVectorFst FSM;
@@ -42,6 +47,102 @@ private:
 
   static FSM *AnyClosureAutomata;
 
+  /// Label 0 is epsilon, 1 is the traversed node and 2 is a wildcard that
+  /// matches any non-epsilon label, symbols are labeled from 3. The wildcard
+  /// is interpreted by the product exploration, it is not expanded into the
+  /// alphabet so it also matches symbols that are added later
+  static const int AnyLabel = 2;
+
+  /// Guards the symbol tables and the counter, the dependence analysis reads
+  /// them concurrently while new symbols are only added during parsing
+  static llvm::sys::SmartRWMutex<true> SymbolsLock;
+
+  /// Guards the query caches
+  static llvm::sys::SmartMutex<true> QueryCacheLock;
+
+  /// Identifies the operands of a memoized automata query, an automata is
+  /// identified by its address and a structural hash since addresses of
+  /// released automata can be reused
+  struct QueryKey {
+    const FSM *First;
+    size_t FirstHash;
+    const FSM *Second;
+    size_t SecondHash;
+
+    bool operator==(const QueryKey &Other) const {
+      return First == Other.First && FirstHash == Other.FirstHash &&
+             Second == Other.Second && SecondHash == Other.SecondHash;
+    }
+  };
+
+  struct QueryKeyHasher {
+    size_t operator()(const QueryKey &Key) const {
+      return llvm::hash_combine(Key.First, Key.FirstHash, Key.Second,
+                                Key.SecondHash);
+    }
+  };
+
+  /// Memoized results of hasNonEmptyIntersection (operands are ordered)
+  static std::unordered_map<QueryKey, bool, QueryKeyHasher> IntersectionCache;
+
+  /// Memoized results of isEmpty (the second operand is always null)
+  static std::unordered_map<QueryKey, bool, QueryKeyHasher> EmptinessCache;
+
+  /// Number of queries answered from the caches
+  static std::atomic<unsigned long> QueryCacheHits;
+
+  /// Number of queries that had to be computed
+  static std::atomic<unsigned long> QueryCacheMisses;
+
+  /// Number of normalized automata and their sizes before and after
+  static std::atomic<unsigned long> NormalizedAutomata;
+  static std::atomic<unsigned long> StatesBeforeNormalize;
+  static std::atomic<unsigned long> ArcsBeforeNormalize;
+  static std::atomic<unsigned long> StatesAfterNormalize;
+  static std::atomic<unsigned long> ArcsAfterNormalize;
+
+  /// Return the number of arcs of the automata
+  static unsigned long getArcsCount(const FSM &Automata);
+
+  /// Build the canonical cache key of a query over one or two automata
+  /// given their structural hashes
+  static QueryKey createQueryKey(const FSM &Automata1, size_t Hash1,
+                                 const FSM *Automata2 = nullptr,
+                                 size_t Hash2 = 0);
+
+  /// Look up a memoized query result, return true if it was found
+  static bool
+  lookupQuery(std::unordered_map<QueryKey, bool, QueryKeyHasher> &Cache,
+              const QueryKey &Key, bool &Result);
+
+  /// Store the result of a query
+  static bool
+  storeQuery(std::unordered_map<QueryKey, bool, QueryKeyHasher> &Cache,
+             const QueryKey &Key, bool Result);
+
+  /// Return the label of a symbol, the symbol must be already added
+  static int getLabel(clang::ValueDecl *Symbol);
+
+  /// Return the label of an abstract access, the access must be already added
+  static int getLabel(int AbstractAccessId);
+
+  /// Uncached emptiness check, a forward reachability search from the start
+  /// state that stops at the first reachable final state
+  static bool computeIsEmpty(const FSM &Automata);
+
+  /// Uncached intersection check, explores the product of the two automata
+  /// on the fly and stops at the first pair of final states
+  static bool computeHasNonEmptyIntersection(const FSM &Automata1,
+                                             const FSM &Automata2);
+
+  /// Collect the non-epsilon arcs of a state sorted by label, the
+  /// destinations of its epsilon arcs and the destinations of its wildcard
+  /// arcs (that are also in LabeledArcs)
+  static void collectArcs(const FSM &Automata, int State,
+                          std::vector<std::pair<int, int>> &LabeledArcs,
+                          std::vector<int> &EpsDestinations,
+                          std::vector<int> &AnyDestinations);
+
 public:
   /// Add a transition symbol to the language and give it a label
   static void addSymbol(clang::ValueDecl *ValueDecl);
@@ -57,29 +158,74 @@ public:
   /// Add epsilon (optional) transition between two states
   static void addEpsTransition(FSM &Automata, int Src, int Dest);
 
-  /// Add a transition between two states on each symbol in the language
+  /// Add a transition between two states that matches any symbol in the
+  /// language, including the traversed node
   static void addAnyTransition(FSM &Automata, int Src, int Dest);
 
+  /// Return the label of the wildcard transitions
+  static int getAnyLabel() { return AnyLabel; }
+
   /// Add a transition on label 1 which is reserved for the current traversed
   /// node
   static void addTraversedNodeTransition(FSM &Automata, int Src, int Dest);
 
-  /// Check if two automata intersect
+  /// Check if two automata intersect, the automata are hashed to look up
+  /// the query cache
   static bool hasNonEmptyIntersection(const FSM &Automata1,
                                       const FSM &Automata2);
 
+  /// Check if two automata intersect given their structural hashes, a cache
+  /// hit does not visit the automata
+  static bool hasNonEmptyIntersection(const FSM &Automata1, size_t Hash1,
+                                      const FSM &Automata2, size_t Hash2);
+
   /// Return an automata that matches a transition on any possible access
   static const FSM &getAnyClosureAutomata();
 
   /// Return a copy of the automata with the root transition removed
   static FSM *CopyRootRemoved(const FSM &In);
 
+  /// Create an empty automata, the caller owns it and releases it with
+  /// destroyFSM
+  static FSM *createFSM() {
+    MemoryStatistics::AutomataCreated++;
+    MemoryStatistics::AutomataLive++;
+    return new FSM();
+  }
+
+  static void destroyFSM(FSM *Automata) {
+    if (!Automata)
+      return;
+    MemoryStatistics::AutomataLive--;
+    delete Automata;
+  }
+
   /// Print the automata into a visual form
   static void print(const FSM &Automata, std::string FileName = "tmp",
                     bool Simplify = false);
 
   /// Check if the automata does not accept any word
   static bool isEmpty(const FSM &Automata);
+
+  /// Check if the automata does not accept any word given its structural
+  /// hash
+  static bool isEmpty(const FSM &Automata, size_t Hash);
+
+  /// Return a hash of the states, arcs and final states of the automata
+  static size_t getStructuralHash(const FSM &Automata);
+
+  /// Drop all memoized query results
+  static void clearQueryCache();
+
+  /// Print the hit/miss counters of the query caches
+  static void printQueryCacheStatistics(llvm::raw_ostream &OS);
+
+  /// Remove the epsilon transitions of the automata, determinize and
+  /// minimize it, the result is sorted on the input labels
+  static void normalize(FSM &Automata);
+
+  /// Print the sizes of the automata before and after normalization
+  static void printNormalizationStatistics(llvm::raw_ostream &OS);
 };
 
 #endif
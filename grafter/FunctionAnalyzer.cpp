@@ -95,9 +95,49 @@ bool FunctionAnalyzer::collectAccessPath_handleStmt(clang::Stmt *Stmt) {
     return collectAccessPath_VisitCallExpr(dyn_cast<clang::CallExpr>(Stmt));
 
   case clang::Stmt::BinaryOperatorClass:
+  case clang::Stmt::CompoundAssignOperatorClass:
     return collectAccessPath_VisitBinaryOperator(
         dyn_cast<clang::BinaryOperator>(Stmt));
 
+  case clang::Stmt::UnaryOperatorClass:
+    return collectAccessPath_VisitUnaryOperator(
+        dyn_cast<clang::UnaryOperator>(Stmt));
+
+  case clang::Stmt::ForStmtClass:
+    NestedLoopDepth++;
+    if (!collectAccessPath_VisitForStmt(dyn_cast<clang::ForStmt>(Stmt))) {
+      NestedLoopDepth--;
+      return false;
+    }
+    NestedLoopDepth--;
+    break;
+
+  case clang::Stmt::WhileStmtClass:
+    NestedLoopDepth++;
+    if (!collectAccessPath_VisitWhileStmt(dyn_cast<clang::WhileStmt>(Stmt))) {
+      NestedLoopDepth--;
+      return false;
+    }
+    NestedLoopDepth--;
+    break;
+
+  case clang::Stmt::DoStmtClass:
+    NestedLoopDepth++;
+    if (!collectAccessPath_VisitDoStmt(dyn_cast<clang::DoStmt>(Stmt))) {
+      NestedLoopDepth--;
+      return false;
+    }
+    NestedLoopDepth--;
+    break;
+
+  case clang::Stmt::BreakStmtClass:
+  case clang::Stmt::ContinueStmtClass:
+    if (NestedLoopDepth == 0)
+      return Logger::getStaticLogger().logError(
+          "FunctionAnalyzer::handleStmt: break and continue are only allowed "
+          "inside loops");
+    break;
+
   case clang::Stmt::IfStmtClass:
     NestedIfDepth++;
     if (!collectAccessPath_VisitIfStmt(dyn_cast<clang::IfStmt>(Stmt))) {
@@ -197,13 +237,12 @@ bool FunctionAnalyzer::collectAccessPath_handleSubExpr(clang::Expr *Expr) {
   Expr = Expr->IgnoreImplicit();
 
   switch (Expr->getStmtClass()) {
-    //  case clang::Stmt::UnaryOperatorClass:
-    //     if (!collectAccessPath_VisitBinaryOperator(
-    //             (dyn_cast<clang::UnaryOperator>(Expr))->getSubExpr()))
-    //       return false;
-    //     break;
+  case clang::Stmt::UnaryOperatorClass:
+    return collectAccessPath_VisitUnaryOperator(
+        dyn_cast<clang::UnaryOperator>(Expr));
 
   case clang::Stmt::BinaryOperatorClass:
+  case clang::Stmt::CompoundAssignOperatorClass:
     if (!collectAccessPath_VisitBinaryOperator(
             dyn_cast<clang::BinaryOperator>(Expr)))
       return false;
@@ -433,6 +472,11 @@ bool FunctionAnalyzer::collectAccessPath_VisitBinaryOperator(
       BinaryExpr->getRHS()->IgnoreImplicit()->getStmtClass() ==
           clang::Stmt::CXXNewExprClass) {
 
+    if (NestedLoopDepth != 0)
+      return Logger::getStaticLogger().logError(
+          "FunctionAnalyzer::collectAccessPath_VisitBinaryOperator: "
+          "new statement not allowed inside loops");
+
     // LHS
     AccessPath *ReplaceNode =
         new AccessPath(BinaryExpr->getLHS()->IgnoreImplicit(), this);
@@ -603,6 +647,14 @@ bool FunctionAnalyzer::collectAccessPath_VisitCallExpr(clang::CallExpr *Expr) {
     return false;
   }
 
+  if (hasFuseAnnotation(Expr->getCalleeDecl()->getAsFunction()) &&
+      NestedLoopDepth != 0) {
+    Logger::getStaticLogger().logError(
+        "FunctionAnalyzer::collectAccessPath_VisitCallExpr: not allowed to "
+        "have recursive calls inside loops ");
+    return false;
+  }
+
   for (auto *Argument : Expr->arguments()) {
     Argument = Argument->IgnoreImplicit();
     if (Argument->getStmtClass() == clang::Stmt::MemberExprClass ||
@@ -649,7 +701,7 @@ bool FunctionAnalyzer::collectAccessPath_VisitCompoundStmt(
     // then we are in the main body because we are not inside and if statement
     ChildStmt = ChildStmt->IgnoreImplicit();
 
-    if (NestedIfDepth == 0) {
+    if (isTopLevel()) {
       bool isTraversingCall =
           (ChildStmt->getStmtClass() == clang::Stmt::CallExprClass ||
            ChildStmt->getStmtClass() == clang::Stmt::CXXMemberCallExprClass) &&
@@ -803,6 +855,11 @@ bool FunctionAnalyzer::collectAccessPath_VisitDeclsStmt(clang::DeclStmt *Stmt) {
     if (VarDecl->getType()->isPointerType()) {
       clang::QualType Type = VarDecl->getType();
 
+      if (NestedLoopDepth != 0)
+        return Logger::getStaticLogger().logError(
+            "FunctionAnalyzer::collectAccessPath_VisitDeclsStmt :Aliasing "
+            "statement not allowed inside loops");
+
       if (!Type.isConstQualified())
         return Logger::getStaticLogger().logError(
             "FunctionAnalyzer::collectAccessPath_VisitDeclsStmt :Aliasing "
@@ -868,9 +925,8 @@ bool FunctionAnalyzer::collectAccessPath_VisitDeclsStmt(clang::DeclStmt *Stmt) {
 
       addAccessPath(NewAccessPath, false);
 
-    } else {
-      if (!collectAccessPath_handleSubExpr(ExprInit))
-        ExprInit->dump();
+    } else if (!collectAccessPath_handleSubExpr(ExprInit)) {
+      ExprInit->dump();
       return Logger::getStaticLogger().logError(
           "FunctionAnalyzer::collectAccessPath_VisitDeclsStmt : "
           "declaration initialization not allowed ");
@@ -879,9 +935,115 @@ bool FunctionAnalyzer::collectAccessPath_VisitDeclsStmt(clang::DeclStmt *Stmt) {
   return true;
 }
 
+bool FunctionAnalyzer::collectAccessPath_handleOperand(clang::Expr *Expr,
+                                                      bool IsWrite) {
+  Expr = Expr->IgnoreImplicit();
+  if (Expr->getStmtClass() != clang::Stmt::MemberExprClass &&
+      Expr->getStmtClass() != clang::Stmt::DeclRefExprClass)
+    return collectAccessPath_handleSubExpr(Expr);
+
+  AccessPath *NewAccessPath = new AccessPath(Expr, this);
+  if (!NewAccessPath->isLegal()) {
+    delete NewAccessPath;
+    return false;
+  }
+  addAccessPath(NewAccessPath, IsWrite);
+
+  if (IsWrite && NewAccessPath->isOnTree() &&
+      NewAccessPath->getValueStartIndex() == -1)
+    return Logger::getStaticLogger().logError(
+        "collectAccessPath_handleOperand: writing to tree nodes not allowed ");
+  return true;
+}
+
+bool FunctionAnalyzer::collectAccessPath_VisitUnaryOperator(
+    clang::UnaryOperator *Expr) {
+  switch (Expr->getOpcode()) {
+  case clang::UO_PostInc:
+  case clang::UO_PostDec:
+  case clang::UO_PreInc:
+  case clang::UO_PreDec:
+    // the written location is read as well, write automata are included in
+    // the read automata
+    return collectAccessPath_handleOperand(Expr->getSubExpr(), true);
+
+  case clang::UO_Plus:
+  case clang::UO_Minus:
+  case clang::UO_Not:
+  case clang::UO_LNot:
+    return collectAccessPath_handleOperand(Expr->getSubExpr(), false);
+
+  default:
+    return Logger::getStaticLogger().logError(
+        "FunctionAnalyzer::collectAccessPath_VisitUnaryOperator: unsupported "
+        "unary operator " +
+        clang::UnaryOperator::getOpcodeStr(Expr->getOpcode()).str());
+  }
+}
+
+// The accesses of a loop are added to the top level statement containing it,
+// since access paths do not depend on the iteration, the union of the accesses
+// of the loop parts summarizes all the iterations
+bool FunctionAnalyzer::collectAccessPath_VisitForStmt(clang::ForStmt *Stmt) {
+  if (Stmt->getInit() && !collectAccessPath_handleStmt(Stmt->getInit()))
+    return Logger::getStaticLogger().logError(
+        "FunctionAnalyzer::collectAccessPath_VisitForStmt unsupported init "
+        "statement");
+
+  if (Stmt->getCond() &&
+      !collectAccessPath_handleOperand(Stmt->getCond(), false))
+    return Logger::getStaticLogger().logError(
+        "FunctionAnalyzer::collectAccessPath_VisitForStmt unsupported "
+        "condition");
+
+  if (Stmt->getInc() && !collectAccessPath_handleSubExpr(Stmt->getInc()))
+    return Logger::getStaticLogger().logError(
+        "FunctionAnalyzer::collectAccessPath_VisitForStmt unsupported "
+        "increment");
+
+  if (Stmt->getBody() &&
+      !collectAccessPath_handleStmt(Stmt->getBody()->IgnoreImplicit()))
+    return Logger::getStaticLogger().logError(
+        "FunctionAnalyzer::collectAccessPath_VisitForStmt unsupported "
+        "statement in loop body");
+  return true;
+}
+
+bool FunctionAnalyzer::collectAccessPath_VisitWhileStmt(
+    clang::WhileStmt *Stmt) {
+  if (!collectAccessPath_handleOperand(Stmt->getCond(), false))
+    return Logger::getStaticLogger().logError(
+        "FunctionAnalyzer::collectAccessPath_VisitWhileStmt unsupported "
+        "condition");
+
+  if (!collectAccessPath_handleStmt(Stmt->getBody()->IgnoreImplicit()))
+    return Logger::getStaticLogger().logError(
+        "FunctionAnalyzer::collectAccessPath_VisitWhileStmt unsupported "
+        "statement in loop body");
+  return true;
+}
+
+bool FunctionAnalyzer::collectAccessPath_VisitDoStmt(clang::DoStmt *Stmt) {
+  if (!collectAccessPath_handleStmt(Stmt->getBody()->IgnoreImplicit()))
+    return Logger::getStaticLogger().logError(
+        "FunctionAnalyzer::collectAccessPath_VisitDoStmt unsupported "
+        "statement in loop body");
+
+  if (!collectAccessPath_handleOperand(Stmt->getCond(), false))
+    return Logger::getStaticLogger().logError(
+        "FunctionAnalyzer::collectAccessPath_VisitDoStmt unsupported "
+        "condition");
+  return true;
+}
+
 bool FunctionAnalyzer::collectAccessPath_VisitCXXDeleteExpr(
     clang::CXXDeleteExpr *Expr) {
 
+  if (NestedLoopDepth != 0)
+    return Logger::getStaticLogger().logError(
+        "FunctionAnalyzer::collectAccessPath_VisitCXXDeleteExpr : delete not "
+        "allowed inside loops");
+
   auto *DeleteDecl = Expr->getOperatorDelete();
 
   if (DeleteDecl->hasBody() || Expr->isArrayForm() || Expr->isGlobalDelete()) {
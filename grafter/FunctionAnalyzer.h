@@ -60,6 +60,13 @@ private:
 
   int NestedIfDepth = 0;
 
+  /// Depth of the loops enclosing the currently analyzed statement, the
+  /// accesses of a loop are summarized in the statement that contains it
+  int NestedLoopDepth = 0;
+
+  /// Return true if the analyzed statement is a top level statement
+  bool isTopLevel() const { return NestedIfDepth == 0 && NestedLoopDepth == 0; }
+
   /// Add an access path to the currently traversed statement information
   void addAccessPath(AccessPath *AccessPath, bool IsRead);
 
@@ -92,6 +99,18 @@ private:
 
   bool collectAccessPath_VisitCXXDeleteExpr(clang::CXXDeleteExpr *Expr);
 
+  bool collectAccessPath_VisitForStmt(clang::ForStmt *Stmt);
+
+  bool collectAccessPath_VisitWhileStmt(clang::WhileStmt *Stmt);
+
+  bool collectAccessPath_VisitDoStmt(clang::DoStmt *Stmt);
+
+  bool collectAccessPath_VisitUnaryOperator(clang::UnaryOperator *Expr);
+
+  /// Collect the accesses of an expression used as an operand, member and
+  /// variable references are added as access paths
+  bool collectAccessPath_handleOperand(clang::Expr *Expr, bool IsWrite);
+
 public:
   bool isVirtual() {
     if (isGlobal())
@@ -14,6 +14,7 @@
 #include "FunctionsFinder.h"
 #include "AccessPath.h"
 #include "Logger.h"
+#include "llvm/Support/RWMutex.h"
 
 #define DEBUG_TYPE "functions-finder"
 
@@ -21,6 +22,10 @@ std::unordered_map<clang::FunctionDecl *, FunctionAnalyzer *>
     FunctionsFinder::FunctionsInformation =
         unordered_map<clang::FunctionDecl *, FunctionAnalyzer *>();
 
+/// Guards the functions table, contexts are analyzed concurrently with
+/// -parallel-tu
+static llvm::sys::SmartRWMutex<true> FunctionsInformationLock;
+
 bool FunctionsFinder::VisitFunctionDecl(clang::FunctionDecl *FuncDeclaration) {
   if (!FuncDeclaration->isThisDeclarationADefinition())
     return true;
@@ -31,27 +36,40 @@ bool FunctionsFinder::VisitFunctionDecl(clang::FunctionDecl *FuncDeclaration) {
 
   FunctionAnalyzer *FuncInfo = new FunctionAnalyzer(FuncDeclaration);
 
+  llvm::sys::SmartScopedWriter<true> Guard(FunctionsInformationLock);
   FunctionsInformation[FuncDeclaration] = FuncInfo;
   // LLVM_DEBUG(if (FuncInfo->isValidFuse()) { FuncInfo->dump(); });
   return true;
 }
 
 bool FunctionsFinder::isValidFuse(clang::FunctionDecl *funcDecl) {
-  if (!FunctionsInformation.count(funcDecl))
+  llvm::sys::SmartScopedReader<true> Guard(FunctionsInformationLock);
+  auto It = FunctionsInformation.find(funcDecl);
+  if (It == FunctionsInformation.end())
     return false;
 
-  return FunctionsInformation[funcDecl]->isValidFuse();
+  return It->second->isValidFuse();
 }
 
 FunctionAnalyzer *
 FunctionsFinder::getFunctionInfo(clang::FunctionDecl *FuncDecl) {
   assert(FuncDecl);
-  assert(FunctionsInformation.count(FuncDecl));
-  return FunctionsInformation[FuncDecl];
+  llvm::sys::SmartScopedReader<true> Guard(FunctionsInformationLock);
+  auto It = FunctionsInformation.find(FuncDecl);
+  assert(It != FunctionsInformation.end());
+  return It->second;
+}
+
+bool FunctionsFinder::hasFunctionInfo(clang::FunctionDecl *FuncDecl) {
+  llvm::sys::SmartScopedReader<true> Guard(FunctionsInformationLock);
+  return FunctionsInformation.count(FuncDecl);
 }
 
 void FunctionsFinder::findFunctions(const ASTContext &Context) {
   TraverseDecl(Context.getTranslationUnitDecl());
+}
+
+void FunctionsFinder::validateFunctions() {
   bool KeepLooping = true;
 
   // Make sure that all traversing calls are to valid fuse function otherwise
@@ -67,9 +85,10 @@ void FunctionsFinder::findFunctions(const ASTContext &Context) {
           auto *CalledFunctionInfo =
               FunctionsFinder::getFunctionInfo(CalledFunction);
           if (CalledFunctionInfo->isVirtual()) {
-            for (auto *PossibleDerviedType : RecordsAnalyzer::DerivedRecords
-                     [TraversingCall.second->getType()
-                          ->getPointeeCXXRecordDecl()]) {
+            for (auto *PossibleDerviedType :
+                 RecordsAnalyzer::getDerivedRecords(
+                     TraversingCall.second->getType()
+                         ->getPointeeCXXRecordDecl())) {
               auto *CalledOverrideFunction =
                   dyn_cast<clang::CXXMethodDecl>(CalledFunction)
                       ->getCorrespondingMethodInClass(PossibleDerviedType);
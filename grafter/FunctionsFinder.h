@@ -28,7 +28,11 @@ public:
 
   /// Initiate a traversal to analyze functions
   void findFunctions(const clang::ASTContext &Context);
-  
+
+  /// Invalidate the functions that call invalid traversals, must be called
+  /// once all the contexts are analyzed
+  void validateFunctions();
+
   /// Returns wether a function is tree-fuser traversal
   bool isValidFuse(clang::FunctionDecl *funcDecl);
 
@@ -36,6 +40,9 @@ public:
   /// delcaration
   static FunctionAnalyzer *getFunctionInfo(clang::FunctionDecl *FuncDecl);
 
+  /// Returns true if the function declaration was analyzed
+  static bool hasFunctionInfo(clang::FunctionDecl *FuncDecl);
+
   bool VisitFunctionDecl(clang::FunctionDecl *funDeclaration);
 };
 
@@ -11,6 +11,9 @@
 #include "FuseTransformation.h"
 #include "DependenceAnalyzer.h"
 #include "DependenceGraph.h"
+#include "FusionCache.h"
+#include "FusionPlanner.h"
+#include "RunStatistics.h"
 
 extern llvm::cl::OptionCategory TreeFuserCategory;
 namespace opts {
@@ -23,17 +26,121 @@ llvm::cl::opt<unsigned>
     MaxMergedNodes("max-merged-n",
                    cl::desc("a maximum number of  that can be fused together"),
                    cl::init(5), cl::ZeroOrMore, cl::cat(TreeFuserCategory));
+llvm::cl::opt<bool> FuseNonAdjacent(
+    "fuse-non-adjacent",
+    cl::desc("fuse calls separated by statements that are independent of "
+             "the traversals"),
+    cl::init(true), cl::Optional, cl::cat(TreeFuserCategory));
 } // namespace opts
 
+/// Return the object accessed by an expression when it is a variable or a
+/// part of a variable (a field or an element of an array), null if the
+/// object is accessed through a pointer
+static const clang::VarDecl *getAccessedVariable(const clang::Expr *Expr) {
+  Expr = Expr->IgnoreParenImpCasts();
+  while (true) {
+    if (auto *Member = dyn_cast<clang::MemberExpr>(Expr)) {
+      if (Member->isArrow())
+        return nullptr;
+      Expr = Member->getBase()->IgnoreParenImpCasts();
+    } else if (auto *Subscript = dyn_cast<clang::ArraySubscriptExpr>(Expr)) {
+      auto *Base = Subscript->getBase()->IgnoreParenImpCasts();
+      if (!Base->getType()->isArrayType())
+        return nullptr;
+      Expr = Base;
+    } else {
+      break;
+    }
+  }
+  if (auto *DeclRef = dyn_cast<clang::DeclRefExpr>(Expr))
+    return dyn_cast<clang::VarDecl>(DeclRef->getDecl());
+  return nullptr;
+}
+
+/// Collect the local variables whose address escapes within a statement,
+/// they may be accessed through pointers and references
+static void collectAliasedLocals(const clang::Stmt *Stmt,
+                                 std::set<const clang::VarDecl *> &Aliased) {
+  if (Stmt == nullptr)
+    return;
+
+  auto addAliased = [&Aliased](const clang::Expr *Expr) {
+    auto *VarDecl = getAccessedVariable(Expr);
+    if (VarDecl && VarDecl->hasLocalStorage())
+      Aliased.insert(VarDecl);
+  };
+
+  // the array of a subscript does not escape
+  if (auto *Subscript = dyn_cast<clang::ArraySubscriptExpr>(Stmt)) {
+    auto *Base = Subscript->getBase()->IgnoreParenImpCasts();
+    collectAliasedLocals(Base->getType()->isArrayType() ? Base
+                                                        : Subscript->getBase(),
+                         Aliased);
+    collectAliasedLocals(Subscript->getIdx(), Aliased);
+    return;
+  }
+
+  if (auto *Unary = dyn_cast<clang::UnaryOperator>(Stmt)) {
+    if (Unary->getOpcode() == clang::UO_AddrOf)
+      addAliased(Unary->getSubExpr());
+  } else if (auto *Cast = dyn_cast<clang::ImplicitCastExpr>(Stmt)) {
+    if (Cast->getCastKind() == clang::CK_ArrayToPointerDecay)
+      addAliased(Cast->getSubExpr());
+  } else if (auto *DeclStmt = dyn_cast<clang::DeclStmt>(Stmt)) {
+    for (auto *Decl : DeclStmt->decls()) {
+      auto *VarDecl = dyn_cast<clang::VarDecl>(Decl);
+      if (VarDecl && VarDecl->getInit() &&
+          VarDecl->getType()->isReferenceType())
+        addAliased(VarDecl->getInit());
+    }
+  } else if (auto *Call = dyn_cast<clang::CallExpr>(Stmt)) {
+    // arguments bound to references, and objects of non const methods
+    if (auto *Callee = Call->getDirectCallee()) {
+      unsigned ArgIdx = isa<clang::CXXOperatorCallExpr>(Call) &&
+                                isa<clang::CXXMethodDecl>(Callee)
+                            ? 1
+                            : 0;
+      for (auto *Param : Callee->parameters()) {
+        if (ArgIdx >= Call->getNumArgs())
+          break;
+        if (Param->getType()->isReferenceType())
+          addAliased(Call->getArg(ArgIdx));
+        ArgIdx++;
+      }
+      auto *Method = dyn_cast<clang::CXXMethodDecl>(Callee);
+      if (Method && !Method->isStatic() && !Method->isConst()) {
+        if (auto *MemberCall = dyn_cast<clang::CXXMemberCallExpr>(Call))
+          addAliased(MemberCall->getImplicitObjectArgument());
+        else if (isa<clang::CXXOperatorCallExpr>(Call))
+          addAliased(Call->getArg(0));
+      }
+    }
+  } else if (auto *Construct = dyn_cast<clang::CXXConstructExpr>(Stmt)) {
+    auto *Constructor = Construct->getConstructor();
+    for (unsigned I = 0;
+         I < Construct->getNumArgs() && I < Constructor->getNumParams(); I++)
+      if (Constructor->getParamDecl(I)->getType()->isReferenceType())
+        addAliased(Construct->getArg(I));
+  } else if (auto *Lambda = dyn_cast<clang::LambdaExpr>(Stmt)) {
+    for (auto &Capture : Lambda->captures())
+      if (Capture.capturesVariable() &&
+          Capture.getCaptureKind() == clang::LCK_ByRef)
+        Aliased.insert(dyn_cast<clang::VarDecl>(Capture.getCapturedVar()));
+  }
+
+  for (auto *Child : Stmt->children())
+    collectAliasedLocals(Child, Aliased);
+}
+
 bool FusionCandidatesFinder::VisitFunctionDecl(clang::FunctionDecl *FuncDecl) {
   CurrentFuncDecl = FuncDecl;
+  if (FuncDecl->doesThisDeclarationHaveABody()) {
+    AliasedLocals.clear();
+    collectAliasedLocals(FuncDecl->getBody(), AliasedLocals);
+  }
   return true;
 }
 
-clang::Rewriter FusionTransformer::Rewriter = clang::Rewriter();
-DependenceAnalyzer FusionTransformer::DepAnalyzer = DependenceAnalyzer();
-TraversalSynthesizer *FusionTransformer::Synthesizer = nullptr;
-
 bool FusionCandidatesFinder::VisitCompoundStmt(
     const CompoundStmt *CompoundStmt) {
 
@@ -44,6 +151,11 @@ bool FusionCandidatesFinder::VisitCompoundStmt(
     if (InnerStmt->getStmtClass() != Stmt::CallExprClass &&
         InnerStmt->getStmtClass() != Stmt::CXXMemberCallExprClass) {
 
+      // Statements that do not interfere with the traversals are executed
+      // before the fused call
+      if (isIndependentStatement(InnerStmt, Candidate))
+        continue;
+
       if (Candidate.size() > 1)
         FusionCandidates[CurrentFuncDecl].push_back(Candidate);
 
@@ -62,10 +174,20 @@ bool FusionCandidatesFinder::VisitCompoundStmt(
     if (areCompatibleCalls(Candidate[0], CurrentCallStmt)) {
       Candidate.push_back(CurrentCallStmt);
     } else {
+      // calls that are not traversals are handled as any other statement
+      if (!areCompatibleCalls(CurrentCallStmt, CurrentCallStmt) &&
+          isIndependentStatement(CurrentCallStmt, Candidate))
+        continue;
+
       if (Candidate.size() > 1)
         FusionCandidates[CurrentFuncDecl].push_back(Candidate);
 
       Candidate.clear();
+
+      // the call can start a new candidate
+      if (opts::FuseNonAdjacent &&
+          areCompatibleCalls(CurrentCallStmt, CurrentCallStmt))
+        Candidate.push_back(CurrentCallStmt);
     }
   }
 
@@ -76,6 +198,303 @@ bool FusionCandidatesFinder::VisitCompoundStmt(
   return true;
 }
 
+/// Collect the fields of a class and of its bases
+static void collectFields(const clang::CXXRecordDecl *RecordDecl,
+                          std::set<const clang::ValueDecl *> &Decls) {
+  if (RecordDecl == nullptr || !RecordDecl->hasDefinition())
+    return;
+  for (auto *Field : RecordDecl->fields())
+    Decls.insert(Field);
+  for (auto &Base : RecordDecl->bases())
+    collectFields(Base.getType()->getAsCXXRecordDecl(), Decls);
+}
+
+/// Collect the variables and the fields referenced within a statement, a
+/// this pointer passed to a call references all the fields of its class
+static void collectReferencedDecls(const clang::Stmt *Stmt,
+                                   std::set<const clang::ValueDecl *> &Decls) {
+  if (Stmt == nullptr)
+    return;
+  if (auto *DeclRef = dyn_cast<clang::DeclRefExpr>(Stmt))
+    Decls.insert(DeclRef->getDecl());
+
+  if (auto *Member = dyn_cast<clang::MemberExpr>(Stmt)) {
+    Decls.insert(Member->getMemberDecl());
+    // the base of the access does not escape
+    auto *Base = Member->getBase()->IgnoreParenImpCasts();
+    if (isa<clang::CXXThisExpr>(Base))
+      return;
+  } else if (auto *This = dyn_cast<clang::CXXThisExpr>(Stmt)) {
+    collectFields(This->getType()->getPointeeCXXRecordDecl(), Decls);
+  }
+
+  for (auto *Child : Stmt->children())
+    collectReferencedDecls(Child, Decls);
+}
+
+/// Return true if the type is (a pointer or a reference to) a tree structure
+static bool isTreeType(clang::QualType Type) {
+  if (Type.isNull())
+    return false;
+  Type = Type.getNonReferenceType();
+  while (Type->isPointerType())
+    Type = Type->getPointeeType();
+  auto *RecordDecl = Type->getAsCXXRecordDecl();
+  return RecordDecl != nullptr && hasTreeAnnotation(RecordDecl);
+}
+
+bool FusionCandidatesFinder::isIndependentStatement(
+    const clang::Stmt *Stmt, const std::vector<clang::CallExpr *> &Candidate) {
+  if (!opts::FuseNonAdjacent || Candidate.empty())
+    return false;
+
+  // The calls of the candidate are commented out from their beginning to the
+  // end of the line
+  auto &SM = Ctx->getSourceManager();
+  if (SM.getExpansionLineNumber(Stmt->getBeginLoc()) ==
+      SM.getExpansionLineNumber(Candidate.back()->getEndLoc()))
+    return false;
+
+  // The arguments of the calls are evaluated at the position of the fused call
+  // and the calls may write to their arguments, hence the statement must not
+  // access any variable that is used by the preceding calls
+  std::set<const clang::ValueDecl *> CandidateVars;
+  for (auto *Call : Candidate)
+    collectReferencedDecls(Call, CandidateVars);
+
+  std::set<clang::VarDecl *> Globals;
+  if (!isIndependentStatementRec(Stmt, CandidateVars, Globals))
+    return false;
+
+  return !accessesTraversalGlobals(Globals, Candidate);
+}
+
+/// Return true if a library function has no effect other than its result,
+/// I/O and the state of the library (printf, cout, rand) are effects
+static bool isEffectFreeLibraryFunction(clang::ASTContext *Ctx,
+                                        const clang::FunctionDecl *Callee) {
+  // the function may write through its parameters (std::swap is constexpr)
+  for (auto *Param : Callee->parameters()) {
+    auto Type = Param->getType();
+    if ((Type->isReferenceType() || Type->isPointerType()) &&
+        !Type->getPointeeType().isConstQualified())
+      return false;
+  }
+
+  if (Callee->hasAttr<clang::ConstAttr>() ||
+      Callee->hasAttr<clang::PureAttr>() || Callee->isConstexpr())
+    return true;
+
+  if (unsigned BuiltinId = Callee->getBuiltinID())
+    return Ctx->BuiltinInfo.isConst(BuiltinId) ||
+           Ctx->BuiltinInfo.isPure(BuiltinId);
+
+  // const member functions only observe the object they are called on
+  if (auto *Method = dyn_cast<clang::CXXMethodDecl>(Callee))
+    return Method->isConst() && !Method->isStatic();
+
+  return false;
+}
+
+bool FusionCandidatesFinder::accessesTraversalGlobals(
+    const std::set<clang::VarDecl *> &Globals,
+    const std::vector<clang::CallExpr *> &Candidate) {
+  if (Globals.empty())
+    return false;
+
+  // An automata that accepts any access path that starts at one of the
+  // globals, the statement is assumed to read and write all of them
+  FSM *StmtAccesses = FSMUtility::createFSM();
+  StmtAccesses->AddState();
+  StmtAccesses->SetStart(0);
+  StmtAccesses->AddState();
+  StmtAccesses->SetFinal(1, 0);
+  FSMUtility::addAnyTransition(*StmtAccesses, 1, 1);
+  for (auto *Global : Globals) {
+    FSMUtility::addSymbol(Global);
+    FSMUtility::addTransition(*StmtAccesses, 0, 1, Global);
+  }
+  fst::ArcSort(StmtAccesses, fst::ILabelCompare<fst::StdArc>());
+
+  // The functions that the calls of the candidate may dispatch to
+  std::set<FunctionAnalyzer *> CalledFunctions;
+  for (auto *Call : Candidate) {
+    auto *Callee = Call->getCalleeDecl()->getAsFunction()->getDefinition();
+    CalledFunctions.insert(FunctionsFinder::getFunctionInfo(Callee));
+
+    auto *Method = dyn_cast<clang::CXXMethodDecl>(Callee);
+    if (Method == nullptr || !Method->isVirtual())
+      continue;
+
+    for (auto *DerivedRecord :
+         RecordsAnalyzer::getDerivedRecords(Method->getParent())) {
+      auto *CalledMethod =
+          Method->getCorrespondingMethodInClass(DerivedRecord)->getDefinition();
+
+      assert(CalledMethod &&
+             "cannot find defintion (declared but not defined)");
+
+      CalledFunctions.insert(FunctionsFinder::getFunctionInfo(CalledMethod));
+    }
+  }
+
+  bool MayConflict = false;
+  for (auto *F : CalledFunctions) {
+    for (auto *Stmt : F->getStatements()) {
+      if (FSMUtility::hasNonEmptyIntersection(*StmtAccesses,
+                                              Stmt->getGlobReadsAutomata()) ||
+          FSMUtility::hasNonEmptyIntersection(*StmtAccesses,
+                                              Stmt->getGlobWritesAutomata())) {
+        MayConflict = true;
+        break;
+      }
+    }
+    if (MayConflict)
+      break;
+  }
+
+  FSMUtility::destroyFSM(StmtAccesses);
+  return MayConflict;
+}
+
+bool FusionCandidatesFinder::isIndependentStatementRec(
+    const clang::Stmt *Stmt,
+    const std::set<const clang::ValueDecl *> &CandidateVars,
+    std::set<clang::VarDecl *> &Globals) {
+  if (Stmt == nullptr)
+    return true;
+
+  switch (Stmt->getStmtClass()) {
+  // control flow would skip the fused call
+  case clang::Stmt::ReturnStmtClass:
+  case clang::Stmt::BreakStmtClass:
+  case clang::Stmt::ContinueStmtClass:
+  case clang::Stmt::GotoStmtClass:
+  case clang::Stmt::IndirectGotoStmtClass:
+  case clang::Stmt::LabelStmtClass:
+  case clang::Stmt::CXXThrowExprClass:
+  case clang::Stmt::CXXTryStmtClass:
+    return false;
+
+  case clang::Stmt::CXXThisExprClass:
+    if (isTreeType(dyn_cast<clang::CXXThisExpr>(Stmt)->getType()))
+      return false;
+    break;
+
+  case clang::Stmt::CXXNewExprClass:
+  case clang::Stmt::CXXDeleteExprClass:
+    // may allocate or free tree nodes
+    return false;
+
+  case clang::Stmt::DeclRefExprClass: {
+    auto *Decl = dyn_cast<clang::DeclRefExpr>(Stmt)->getDecl();
+    if (CandidateVars.count(Decl))
+      return false;
+
+    auto *VarDecl = dyn_cast<clang::VarDecl>(Decl);
+    if (VarDecl == nullptr)
+      break;
+
+    // a reference or a local whose address escapes may alias the arguments
+    if (VarDecl->getType()->isReferenceType() || AliasedLocals.count(VarDecl))
+      return false;
+
+    // Globals are checked against the access sets of the traversals
+    if (VarDecl->hasGlobalStorage())
+      Globals.insert(VarDecl);
+    break;
+  }
+
+  case clang::Stmt::MemberExprClass: {
+    auto *Member = dyn_cast<clang::MemberExpr>(Stmt);
+    if (CandidateVars.count(Member->getMemberDecl()))
+      return false;
+
+    // only the fields of this are read through a pointer, their writes are
+    // rejected with the other writes through pointers
+    if (Member->isArrow() &&
+        !isa<clang::CXXThisExpr>(Member->getBase()->IgnoreParenImpCasts()))
+      return false;
+    break;
+  }
+
+  case clang::Stmt::ArraySubscriptExprClass: {
+    auto *Base = dyn_cast<clang::ArraySubscriptExpr>(Stmt)->getBase();
+    if (!Base->IgnoreParenImpCasts()->getType()->isArrayType())
+      return false;
+    break;
+  }
+
+  case clang::Stmt::UnaryOperatorClass: {
+    auto *Unary = dyn_cast<clang::UnaryOperator>(Stmt);
+    if (Unary->getOpcode() == clang::UO_Deref)
+      return false;
+    if (Unary->isIncrementDecrementOp() &&
+        getAccessedVariable(Unary->getSubExpr()) == nullptr)
+      return false;
+    break;
+  }
+
+  case clang::Stmt::BinaryOperatorClass:
+  case clang::Stmt::CompoundAssignOperatorClass: {
+    auto *Binary = dyn_cast<clang::BinaryOperator>(Stmt);
+    if (Binary->isAssignmentOp() &&
+        getAccessedVariable(Binary->getLHS()) == nullptr)
+      return false;
+    break;
+  }
+
+  case clang::Stmt::CallExprClass:
+  case clang::Stmt::CXXMemberCallExprClass:
+  case clang::Stmt::CXXOperatorCallExprClass: {
+    // The effects of user functions are not known, only calls to library
+    // functions without side effects are allowed
+    auto *Callee = dyn_cast<clang::CallExpr>(Stmt)->getDirectCallee();
+    if (Callee == nullptr ||
+        !Ctx->getSourceManager().isInSystemHeader(Callee->getLocation()) ||
+        !isEffectFreeLibraryFunction(Ctx, Callee))
+      return false;
+    break;
+  }
+
+  case clang::Stmt::CXXConstructExprClass: {
+    auto *Constructor =
+        dyn_cast<clang::CXXConstructExpr>(Stmt)->getConstructor();
+    // library constructors may perform I/O as well (e.g. ofstream)
+    if (!Constructor->isTrivial() && !Constructor->isConstexpr())
+      return false;
+    break;
+  }
+
+  case clang::Stmt::DeclStmtClass: {
+    // Tree nodes must not be aliased by the statement
+    for (auto *Decl : dyn_cast<clang::DeclStmt>(Stmt)->decls()) {
+      auto *VarDecl = dyn_cast<clang::VarDecl>(Decl);
+      if (VarDecl == nullptr || VarDecl->isStaticLocal() ||
+          isTreeType(VarDecl->getType()))
+        return false;
+      if (VarDecl->getInit() &&
+          !isIndependentStatementRec(VarDecl->getInit(), CandidateVars,
+                                     Globals))
+        return false;
+    }
+    return true;
+  }
+
+  default:
+    break;
+  }
+
+  if (auto *Expr = dyn_cast<clang::Expr>(Stmt))
+    if (isTreeType(Expr->getType()))
+      return false;
+
+  for (auto *Child : Stmt->children())
+    if (!isIndependentStatementRec(Child, CandidateVars, Globals))
+      return false;
+  return true;
+}
+
 AccessPath extractVisitedChild(clang::CallExpr *Call) {
   if (Call->getStmtClass() == clang::Stmt::CXXMemberCallExprClass) {
     auto *ExprCallRemoved =
@@ -122,10 +541,11 @@ FusionTransformer::FusionTransformer(ASTContext *Ctx,
   Rewriter.setSourceMgr(Ctx->getSourceManager(), Ctx->getLangOpts());
   this->Ctx = Ctx;
   this->FunctionsInformation = FunctionsInfo;
-  if (!this->Synthesizer)
-    this->Synthesizer = new TraversalSynthesizer(Ctx, Rewriter, this);
+  this->Synthesizer = new TraversalSynthesizer(Ctx, Rewriter, this);
 }
 
+FusionTransformer::~FusionTransformer() { delete Synthesizer; }
+
 void FusionTransformer::performFusion(
     const vector<clang::CallExpr *> &Candidate, bool IsTopLevel,
     clang::FunctionDecl *EnclosingFunctionDecl /*just needed fo top level*/) {
@@ -133,6 +553,9 @@ void FusionTransformer::performFusion(
   bool HasVirtual = false;
   bool HasCXXMethod = false;
 
+  if (IsTopLevel)
+    RunStatistics::count(RC_Candidates);
+
   for (auto *Call : Candidate) {
     auto *CalleeInfo = FunctionsFinder::getFunctionInfo(
         Call->getCalleeDecl()->getAsFunction()->getDefinition());
@@ -141,6 +564,18 @@ void FusionTransformer::performFusion(
     if (CalleeInfo->isVirtual())
       HasVirtual = true;
   }
+
+  // Reuse the functions synthesized for the same inputs by a previous run
+  std::vector<clang::FunctionDecl *> CachedTraversals;
+  std::string CacheKey;
+  if (IsTopLevel && !HasVirtual && FusionCache::isEnabled())
+    CacheKey = FusionCache::getKey(Candidate, CachedTraversals);
+  if (!CacheKey.empty() &&
+      FusionCache::lookup(CacheKey, CachedTraversals, Synthesizer)) {
+    Synthesizer->WriteUpdates(Candidate, EnclosingFunctionDecl);
+    return;
+  }
+
   AccessPath AP = extractVisitedChild(Candidate[0]);
 
   bool SelfCall =
@@ -164,12 +599,26 @@ void FusionTransformer::performFusion(
 
       Logger::getStaticLogger().logInfo("Creating DG for a candidate");
 
-      DependenceGraph *DepGraph =
-          DepAnalyzer.createDependenceGraph(Candidate, HasVirtual, DerivedType);
+      CandidateStatistics Statistics;
+      Statistics.Name =
+          Synthesizer->createName(Candidate, HasVirtual, DerivedType);
+      // the work of concurrent candidates is counted by their threads
+      CounterSet StartCounters = RunStatistics::beginThreadWork();
+
+      DependenceGraph *DepGraph;
+      {
+        PhaseTimer Timer(RP_DependenceGraph, &Statistics);
+        DepGraph = DepAnalyzer.createDependenceGraph(Candidate, HasVirtual,
+                                                     DerivedType);
+      }
 
       // DepGraph->dump();
 
-      performGreedyFusion(DepGraph);
+      {
+        PhaseTimer Timer(RP_Fusion, &Statistics);
+        FusionPlanner Planner(DepGraph);
+        Planner.plan();
+      }
 
       LLVM_DEBUG(DepGraph->dumpMergeInfo());
 
@@ -177,115 +626,60 @@ void FusionTransformer::performFusion(
       assert(!DepGraph->hasCycle() && "dep graph has cycle");
       assert(!DepGraph->hasWrongFuse() && "dep graph has wrong merging");
 
-      std::vector<DG_Node *> ToplogicalOrder = findToplogicalOrder(DepGraph);
+      std::vector<DG_Node *> ToplogicalOrder;
+      {
+        PhaseTimer Timer(RP_TopologicalOrder, &Statistics);
+        ToplogicalOrder = findToplogicalOrder(DepGraph);
+      }
 
-      Synthesizer->generateWriteBackInfo(Candidate, ToplogicalOrder, HasVirtual,
-                                         HasCXXMethod, DerivedType);
+      {
+        PhaseTimer Timer(RP_Synthesis, &Statistics);
+        Synthesizer->generateWriteBackInfo(Candidate, ToplogicalOrder,
+                                           HasVirtual, HasCXXMethod,
+                                           DerivedType);
+      }
+      RunStatistics::count(RC_SynthesizedFunctions);
+
+      // the work done for the function (and for the functions it calls)
+      CounterSet Work = RunStatistics::endThreadWork(StartCounters);
+      for (int Counter = 0; Counter < RC_Count; Counter++)
+        Statistics.Counters[Counter] = Work.Values[Counter];
+      RunStatistics::addCandidate(Statistics);
+
+      // The synthesized text no longer refers to the graph
+      delete DepGraph;
       // Logger::getStaticLogger().logDebug("Code Generation Done ");
     }
   };
   if (HasVirtual) {
     fuseFunctions(TraversedType);
-    for (auto *DerivedType : RecordsAnalyzer::DerivedRecords[TraversedType]) {
+    for (auto *DerivedType :
+         RecordsAnalyzer::getDerivedRecords(TraversedType)) {
       fuseFunctions(DerivedType);
     }
   } else
     fuseFunctions(nullptr);
 
   if (IsTopLevel) {
+    if (!CacheKey.empty())
+      FusionCache::store(CacheKey, CachedTraversals, Synthesizer,
+                         Synthesizer->createName(Candidate, false, nullptr));
 
+    PhaseTimer Timer(RP_Synthesis);
     Synthesizer->WriteUpdates(Candidate, EnclosingFunctionDecl);
   }
 }
 
-void FusionTransformer::performGreedyFusion(DependenceGraph *DepGraph) {
-  unordered_map<clang::FieldDecl *, vector<DG_Node *>> ChildToCallers;
-  for (auto *Node : DepGraph->getNodes()) {
-    if (Node->getStatementInfo()->isCallStmt()) {
-      ChildToCallers[Node->getStatementInfo()->getCalledChild()].push_back(
-          Node);
-    }
-  }
-
-  LLVM_DEBUG(for (auto &Entry
-                  : ChildToCallers) {
-    outs() << Entry.first->getNameAsString() << ":" << Entry.second.size()
-           << "\n";
-  });
-  vector<unordered_map<clang::FieldDecl *, vector<DG_Node *>>::iterator>
-      IteratorsList;
-
-  for (auto It = ChildToCallers.begin(); It != ChildToCallers.end(); It++)
-    IteratorsList.push_back(It);
-
-  srand(time(nullptr));
-  // random_shuffle(itList.begin(), itList.end());
-  // random_shuffle(itList.begin(), itList.end());
-  // random_shuffle(itList.begin(), itList.end());
-
-  for (auto It : IteratorsList) {
-    vector<DG_Node *> &CallNodes = It->second;
-
-    // reverse(CallNodes.begin(), CallNodes.end());
-    // random_shuffle(nodeLst.begin(), nodeLst.end());
-    // random_shuffle(nodeLst.begin(), nodeLst.end());
-    // random_shuffle(nodeLst.begin(), nodeLst.end());
-
-    for (int i = 0; i < CallNodes.size(); i++) {
-      if (CallNodes[i]->isMerged())
-        continue;
-
-      for (int j = i + 1; j < CallNodes.size(); j++) {
-        if (CallNodes[j]->isMerged())
-          continue;
-
-        DepGraph->merge(CallNodes[i], CallNodes[j]);
-
-        auto ReachMaxMerged = [&](MergeInfo *Info) {
-          unordered_map<FunctionDecl *, int> Counter;
-          for (auto *Node : Info->MergedNodes) {
-            Counter[Node->getStatementInfo()
-                        ->getCalledFunction()
-                        ->getDefinition()]++;
-            auto Count = Counter[Node->getStatementInfo()
-                                     ->getCalledFunction()
-                                     ->getDefinition()];
-
-            if (Count > opts::MaxMergedInstances) {
-              return true;
-            }
-          }
-          return false;
-        };
-
-        if (CallNodes[i]->getMergeInfo()->MergedNodes.size() >
-                opts::MaxMergedNodes ||
-            ReachMaxMerged(CallNodes[i]->getMergeInfo()) ||
-            DepGraph->hasCycle() ||
-            DepGraph->hasWrongFuse(CallNodes[i]->getMergeInfo())) {
-          LLVM_DEBUG(outs()
-                     << "rollback on merge, " << DepGraph->hasCycle() << ","
-                     << DepGraph->hasWrongFuse(CallNodes[i]->getMergeInfo())
-                     << "\n");
-
-          DepGraph->unmerge(CallNodes[j]);
-        }
-      }
-    }
-  }
-}
-
 void FusionTransformer::findToplogicalOrderRec(
-    vector<DG_Node *> &TopOrder, unordered_map<DG_Node *, bool> &Visited,
-    DG_Node *Node) {
+    vector<DG_Node *> &TopOrder, llvm::BitVector &Visited, DG_Node *Node) {
   if (!Node->allPredesVisited(Visited))
     return;
 
   TopOrder.push_back(Node);
   if (!Node->isMerged()) {
-    Visited[Node] = true;
+    Visited.set(Node->getIndex());
     for (auto &SuccDep : Node->getSuccessors()) {
-      if (!Visited[SuccDep.first])
+      if (!Visited.test(SuccDep.first->getIndex()))
         findToplogicalOrderRec(TopOrder, Visited, SuccDep.first);
     }
     return;
@@ -293,8 +687,8 @@ void FusionTransformer::findToplogicalOrderRec(
 
   // Handle merged node
   for (auto *MergedNode : Node->getMergeInfo()->MergedNodes) {
-    assert(!Visited[MergedNode]);
-    Visited[MergedNode] = true;
+    assert(!Visited.test(MergedNode->getIndex()));
+    Visited.set(MergedNode->getIndex());
   }
 
   for (auto *MergedNode : Node->getMergeInfo()->MergedNodes) {
@@ -304,7 +698,7 @@ void FusionTransformer::findToplogicalOrderRec(
         continue;
 
       // WRONG ASSERTION
-      if (!Visited[SuccDep.first])
+      if (!Visited.test(SuccDep.first->getIndex()))
         findToplogicalOrderRec(TopOrder, Visited, SuccDep.first);
     }
   }
@@ -312,14 +706,14 @@ void FusionTransformer::findToplogicalOrderRec(
 
 std::vector<DG_Node *>
 FusionTransformer::findToplogicalOrder(DependenceGraph *DepGraph) {
-  std::unordered_map<DG_Node *, bool> Visited;
+  llvm::BitVector Visited(DepGraph->getNodes().size());
   std::vector<DG_Node *> Order;
 
   bool AllVisited = false;
   while (!AllVisited) {
     AllVisited = true;
     for (auto *Node : DepGraph->getNodes()) {
-      if (!Visited[Node]) {
+      if (!Visited.test(Node->getIndex())) {
         AllVisited = false;
         findToplogicalOrderRec(Order, Visited, Node);
       }
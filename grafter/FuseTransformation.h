@@ -42,9 +42,33 @@ private:
   /// Analyzed information for the functions within the same Ctx
   FunctionsFinder *FunctionsInformation;
 
+  /// Locals of the current function whose address escapes (taken, bound to
+  /// a reference or captured by reference)
+  std::set<const clang::VarDecl *> AliasedLocals;
+
   /// Return true if two calls traverse the same tree from the same node
   bool areCompatibleCalls(clang::CallExpr *Call1, clang::CallExpr *Call2);
 
+  /// Return true if a statement that appears between the calls of a candidate
+  /// can be executed before all the calls of the candidate, the fused call is
+  /// placed after the last call of the candidate
+  bool isIndependentStatement(const clang::Stmt *Stmt,
+                              const std::vector<clang::CallExpr *> &Candidate);
+
+  /// Return true if the statement has no effect that conflicts with the
+  /// traversals, the variables that the statement must not access are in
+  /// CandidateVars and the globals that it accesses are added to Globals
+  bool isIndependentStatementRec(
+      const clang::Stmt *Stmt,
+      const std::set<const clang::ValueDecl *> &CandidateVars,
+      std::set<clang::VarDecl *> &Globals);
+
+  /// Return true if the access sets of the traversals called by the candidate
+  /// may intersect an access to one of the given globals
+  bool
+  accessesTraversalGlobals(const std::set<clang::VarDecl *> &Globals,
+                           const std::vector<clang::CallExpr *> &Candidate);
+
 public:
   /// Search the source code for valid fusion candidates
   void findCandidates() { this->TraverseDecl(Ctx->getTranslationUnitDecl()); }
@@ -64,12 +88,13 @@ public:
 class TraversalSynthesizer;
 class FusionTransformer {
 private:
-  static clang::Rewriter Rewriter;
+  /// The rewriter, the dependence analyzer and the synthesizer are owned by
+  /// the transformer of each context
+  clang::Rewriter Rewriter;
   FunctionsFinder *FunctionsInformation;
   ASTContext *Ctx;
-  static DependenceAnalyzer DepAnalyzer;
-  static TraversalSynthesizer *Synthesizer;
-
+  DependenceAnalyzer DepAnalyzer;
+  TraversalSynthesizer *Synthesizer;
 
 public:
   /// Perform fusion transformation on a given list of candidates
@@ -80,15 +105,14 @@ public:
   /// Commiting source code updates to the source files
   void overwriteChangedFiles() { Rewriter.overwriteChangedFiles(); }
 
-  void performGreedyFusion(DependenceGraph *DepGraph);
-
   vector<DG_Node *> findToplogicalOrder(DependenceGraph *DepGraph);
 
   void findToplogicalOrderRec(vector<DG_Node *> &topOrder,
-                              unordered_map<DG_Node *, bool> &visited,
-                              DG_Node *node);
+                              llvm::BitVector &visited, DG_Node *node);
 
   FusionTransformer(ASTContext *Ctx, FunctionsFinder *FunctionsInfo);
+
+  ~FusionTransformer();
 };
 
 #endif
@@ -0,0 +1,346 @@
+//===--- FusionCache.cpp --------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//===----------------------------------------------------------------------===//
+
+#include "FusionCache.h"
+#include "FunctionsFinder.h"
+#include "Logger.h"
+#include "RecordAnalyzer.h"
+#include "TraversalSynthesizer.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include <atomic>
+#include <map>
+#include <set>
+
+#define DEBUG_TYPE "fusion-cache"
+
+extern llvm::cl::OptionCategory TreeFuserCategory;
+
+namespace opts {
+llvm::cl::opt<std::string> FusionCacheDir(
+    "fusion-cache-dir",
+    cl::desc("directory of the persistent cache of synthesized traversals"),
+    cl::init(""), cl::Optional, cl::cat(TreeFuserCategory));
+} // namespace opts
+
+std::string FusionCache::CommandLine;
+
+static std::atomic<unsigned> CacheHits(0);
+static std::atomic<unsigned> CacheMisses(0);
+
+/// First line of every entry, changes when the format of the entries changes
+static const char *const EntryHeader = "grafter-fusion-cache 1";
+
+/// Prefix of the names of the synthesized traversals
+static const StringRef FusePrefix = "_fuse__";
+
+bool FusionCache::isEnabled() { return !opts::FusionCacheDir.empty(); }
+
+void FusionCache::setCommandLine(int Argc, const char **Argv) {
+  CommandLine.clear();
+  for (int I = 1; I < Argc; I++)
+    CommandLine += std::string(Argv[I]) + "\n";
+}
+
+std::string FusionCache::getEntryPath(const std::string &Key) {
+  SmallString<128> Path(opts::FusionCacheDir);
+  llvm::sys::path::append(Path, Key + ".fusion");
+  return Path.str();
+}
+
+/// Return the source text of a declaration
+static std::string getSourceText(const clang::Decl *Decl) {
+  auto &Ctx = Decl->getASTContext();
+  return clang::Lexer::getSourceText(
+             clang::CharSourceRange::getTokenRange(Decl->getSourceRange()),
+             Ctx.getSourceManager(), Ctx.getLangOpts())
+      .str();
+}
+
+/// Collect the calls within a statement
+static void collectCalls(clang::Stmt *Stmt,
+                         std::vector<clang::CallExpr *> &Calls) {
+  if (Stmt == nullptr)
+    return;
+  if (auto *Call = dyn_cast<clang::CallExpr>(Stmt))
+    Calls.push_back(Call);
+  for (auto *Child : Stmt->children())
+    collectCalls(Child, Calls);
+}
+
+/// Rewrite the function ids in the synthesized names of Text (_fuse__F3F7)
+/// into placeholders (_fuse__F{0}F{1}) or the reverse, the ids or the
+/// positions are translated with Mapping. Return false if a name refers to a
+/// function that is not in Mapping
+static bool rewriteNames(StringRef Text, bool ToPlaceholders,
+                         const std::map<unsigned, unsigned> &Mapping,
+                         std::string &Output) {
+  Output.clear();
+  size_t Pos = 0;
+  while (true) {
+    size_t Next = Text.find(FusePrefix, Pos);
+    if (Next == StringRef::npos) {
+      Output += Text.substr(Pos);
+      return true;
+    }
+    Next += FusePrefix.size();
+    Output += Text.substr(Pos, Next - Pos);
+    Pos = Next;
+
+    while (Pos < Text.size() && Text[Pos] == 'F') {
+      size_t Start = Pos + 1;
+      if (!ToPlaceholders) {
+        if (Start >= Text.size() || Text[Start] != '{')
+          break;
+        Start++;
+      }
+      size_t End = Start;
+      while (End < Text.size() && isdigit(Text[End]))
+        End++;
+
+      unsigned Value;
+      if (Text.substr(Start, End - Start).getAsInteger(10, Value))
+        break;
+      if (!ToPlaceholders) {
+        if (End >= Text.size() || Text[End] != '}')
+          return false;
+        End++;
+      }
+
+      auto It = Mapping.find(Value);
+      if (It == Mapping.end())
+        return false;
+      Output += ToPlaceholders ? "F{" + to_string(It->second) + "}"
+                               : "F" + to_string(It->second);
+      Pos = End;
+    }
+  }
+}
+
+std::string
+FusionCache::getKey(const std::vector<clang::CallExpr *> &Candidate,
+                    std::vector<clang::FunctionDecl *> &Traversals) {
+  Traversals.clear();
+  if (!isEnabled())
+    return "";
+
+  std::set<clang::FunctionDecl *> VisitedTraversals;
+  auto AddTraversal = [&](clang::FunctionDecl *Decl) {
+    Decl = Decl->getDefinition();
+    if (Decl == nullptr || !FunctionsFinder::hasFunctionInfo(Decl) ||
+        FunctionsFinder::getFunctionInfo(Decl)->isVirtual())
+      return false;
+    if (VisitedTraversals.insert(Decl).second)
+      Traversals.push_back(Decl);
+    return true;
+  };
+
+  for (auto *Call : Candidate)
+    if (!AddTraversal(Call->getCalleeDecl()->getAsFunction()))
+      return "";
+
+  llvm::MD5 Hash;
+  Hash.update(CommandLine);
+
+  std::set<const clang::Decl *> HashedDecls;
+  auto HashDecl = [&](const clang::Decl *Decl) {
+    if (!HashedDecls.insert(Decl).second)
+      return;
+    Hash.update(getSourceText(Decl));
+    Hash.update("\n");
+  };
+
+  // Traversals reachable from the candidate, the list grows while visited
+  std::vector<const clang::CXXRecordDecl *> Records;
+  for (unsigned I = 0; I < Traversals.size(); I++) {
+    auto *Traversal = Traversals[I];
+    Hash.update(Traversal->getQualifiedNameAsString());
+    HashDecl(Traversal);
+
+    std::vector<clang::CallExpr *> Calls;
+    collectCalls(Traversal->getBody(), Calls);
+    for (auto *Call : Calls) {
+      auto *Callee = Call->getDirectCallee();
+      if (Callee == nullptr)
+        return "";
+      if (hasFuseAnnotation(Callee)) {
+        if (!AddTraversal(Callee))
+          return "";
+      } else {
+        // the annotations of the called functions drive the analysis
+        HashDecl(Callee);
+      }
+    }
+
+    if (auto *Record = dyn_cast_or_null<clang::CXXRecordDecl>(
+            FunctionsFinder::getFunctionInfo(Traversal)
+                ->getTraversedTreeTypeDecl()))
+      Records.push_back(Record);
+  }
+
+  // The traversed records with their bases and derived records
+  std::set<const clang::CXXRecordDecl *> VisitedRecords(Records.begin(),
+                                                        Records.end());
+  for (unsigned I = 0; I < Records.size(); I++) {
+    auto *Record = Records[I];
+    HashDecl(Record);
+
+    std::vector<const clang::CXXRecordDecl *> Related(
+        RecordsAnalyzer::getDerivedRecords(Record));
+    for (auto &Base : Record->bases())
+      Related.push_back(Base.getType()->getAsCXXRecordDecl());
+
+    for (auto *RelatedRecord : Related)
+      if (RelatedRecord && VisitedRecords.insert(RelatedRecord).second)
+        Records.push_back(RelatedRecord);
+  }
+
+  llvm::MD5::MD5Result Result;
+  Hash.final(Result);
+  SmallString<32> Key;
+  llvm::MD5::stringifyResult(Result, Key);
+  return Key.str();
+}
+
+bool FusionCache::lookup(const std::string &Key,
+                         const std::vector<clang::FunctionDecl *> &Traversals,
+                         TraversalSynthesizer *Synthesizer) {
+  auto Buffer = llvm::MemoryBuffer::getFile(getEntryPath(Key));
+  if (!Buffer) {
+    CacheMisses++;
+    return false;
+  }
+
+  // Ids of the traversals of the entry in this run
+  std::map<unsigned, unsigned> IndexToId;
+  for (unsigned I = 0; I < Traversals.size(); I++) {
+    Synthesizer->createName(std::vector<clang::FunctionDecl *>{Traversals[I]});
+    IndexToId[I] = Synthesizer->getFunctionId(Traversals[I]);
+  }
+
+  std::vector<FusedTraversalWritebackInfo *> Functions;
+  auto Fail = [&]() {
+    for (auto *Info : Functions)
+      delete Info;
+    Logger::getStaticLogger().logWarn("ignoring malformed fusion cache entry " +
+                                      Key);
+    CacheMisses++;
+    return false;
+  };
+
+  // Entry format: the header, the number of functions, then for each
+  // function its name, the sizes of its forward declaration and definition
+  // and both texts
+  StringRef Data = Buffer.get()->getBuffer();
+  StringRef Line;
+  std::tie(Line, Data) = Data.split('\n');
+  if (Line != EntryHeader)
+    return Fail();
+
+  unsigned Count;
+  std::tie(Line, Data) = Data.split('\n');
+  if (Line.getAsInteger(10, Count) || Count == 0)
+    return Fail();
+
+  for (unsigned I = 0; I < Count; I++) {
+    StringRef Name, Sizes, ForwardSize, DefinitionSize;
+    std::tie(Name, Data) = Data.split('\n');
+    std::tie(Sizes, Data) = Data.split('\n');
+    std::tie(ForwardSize, DefinitionSize) = Sizes.split(' ');
+
+    size_t ForwardLength, DefinitionLength;
+    if (ForwardSize.getAsInteger(10, ForwardLength) ||
+        DefinitionSize.getAsInteger(10, DefinitionLength) ||
+        Data.size() < ForwardLength + DefinitionLength)
+      return Fail();
+
+    auto *Info = new FusedTraversalWritebackInfo();
+    Functions.push_back(Info);
+    if (!rewriteNames(Name, false, IndexToId, Info->FunctionName) ||
+        !rewriteNames(Data.substr(0, ForwardLength), false, IndexToId,
+                      Info->ForwardDeclaration) ||
+        !rewriteNames(Data.substr(ForwardLength, DefinitionLength), false,
+                      IndexToId, Info->CachedDefinition))
+      return Fail();
+    Data = Data.drop_front(ForwardLength + DefinitionLength);
+  }
+
+  Logger::getStaticLogger().logInfo("Reusing cached code for function " +
+                                    Functions.front()->FunctionName);
+  for (auto *Info : Functions)
+    Synthesizer->addCachedFunction(Info);
+  CacheHits++;
+  return true;
+}
+
+void FusionCache::store(const std::string &Key,
+                        const std::vector<clang::FunctionDecl *> &Traversals,
+                        TraversalSynthesizer *Synthesizer,
+                        const std::string &FunctionName) {
+  std::map<unsigned, unsigned> IdToIndex;
+  for (unsigned I = 0; I < Traversals.size(); I++) {
+    Synthesizer->createName(std::vector<clang::FunctionDecl *>{Traversals[I]});
+    IdToIndex[Synthesizer->getFunctionId(Traversals[I])] = I;
+  }
+
+  // The requested function comes first, the lookup reports its name
+  std::string Entry = std::string(EntryHeader) + "\n";
+  auto Closure = Synthesizer->getFunctionClosure(FunctionName);
+  Entry += to_string(Closure.size()) + "\n";
+  for (auto *Info : Closure) {
+    std::string Definition = Synthesizer->getFunctionDefinition(Info);
+    std::string Name, ForwardText, DefinitionText;
+    if (Definition.find("__virtualStub") != std::string::npos ||
+        !rewriteNames(Info->FunctionName, true, IdToIndex, Name) ||
+        !rewriteNames(Info->ForwardDeclaration, true, IdToIndex,
+                      ForwardText) ||
+        !rewriteNames(Definition, true, IdToIndex, DefinitionText)) {
+      LLVM_DEBUG(outs() << "fusion of " << FunctionName
+                        << " can not be cached\n");
+      return;
+    }
+    Entry += Name + "\n" + to_string(ForwardText.size()) + " " +
+             to_string(DefinitionText.size()) + "\n" + ForwardText +
+             DefinitionText;
+  }
+
+  if (llvm::sys::fs::create_directories(opts::FusionCacheDir)) {
+    Logger::getStaticLogger().logWarn("cannot create fusion cache directory " +
+                                      opts::FusionCacheDir);
+    return;
+  }
+
+  // Written to a temporary file then renamed, concurrent runs may store the
+  // same entry
+  int FD;
+  SmallString<128> TempPath;
+  if (llvm::sys::fs::createUniqueFile(getEntryPath(Key) + "-%%%%%%.tmp", FD,
+                                      TempPath)) {
+    Logger::getStaticLogger().logWarn("cannot write fusion cache entry " +
+                                      Key);
+    return;
+  }
+  {
+    llvm::raw_fd_ostream OS(FD, /*shouldClose*/ true);
+    OS << Entry;
+  }
+  if (llvm::sys::fs::rename(TempPath, getEntryPath(Key))) {
+    llvm::sys::fs::remove(TempPath);
+    Logger::getStaticLogger().logWarn("cannot write fusion cache entry " +
+                                      Key);
+  }
+}
+
+void FusionCache::printStatistics(llvm::raw_ostream &OS) {
+  OS << "fusion cache: " << CacheHits << " hits, " << CacheMisses
+     << " misses\n";
+}
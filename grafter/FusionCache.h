@@ -0,0 +1,71 @@
+//===--- FusionCache.h ----------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// A persistent cache of synthesized traversals, enabled with
+// -fusion-cache-dir. For each top level candidate the cache stores the
+// forward declarations and the definitions of all the functions synthesized
+// for it, so that a later run skips the dependence analysis, the planning and
+// the synthesis of candidates whose inputs did not change.
+//
+// An entry is addressed by the MD5 of the command line options, of the source
+// of the traversals reachable from the candidate (and of the declarations of
+// the functions they call) and of the tree records they traverse. Synthesized
+// names embed per run function ids, the cached text replaces them with
+// placeholders that refer to the traversals of the entry by position.
+//
+// Candidates that involve virtual traversals are not cached since their stubs
+// are added to the tree classes.
+//===----------------------------------------------------------------------===//
+
+#ifndef TREE_FUSER_FUSION_CACHE
+#define TREE_FUSER_FUSION_CACHE
+
+#include "LLVMDependencies.h"
+#include <string>
+#include <vector>
+
+class TraversalSynthesizer;
+
+class FusionCache {
+private:
+  /// The command line of the run, options change the synthesized code
+  static std::string CommandLine;
+
+  /// Return the path of the entry with the given key
+  static std::string getEntryPath(const std::string &Key);
+
+public:
+  /// Return true if -fusion-cache-dir is given
+  static bool isEnabled();
+
+  /// Record the command line that is part of every key
+  static void setCommandLine(int Argc, const char **Argv);
+
+  /// Return the key of a top level candidate and fill Traversals with the
+  /// traversals reachable from it, return an empty key if the candidate can
+  /// not be cached
+  static std::string
+  getKey(const std::vector<clang::CallExpr *> &Candidate,
+         std::vector<clang::FunctionDecl *> &Traversals);
+
+  /// Add the functions of the entry to the synthesizer, return false on a miss
+  static bool lookup(const std::string &Key,
+                     const std::vector<clang::FunctionDecl *> &Traversals,
+                     TraversalSynthesizer *Synthesizer);
+
+  /// Store the functions synthesized for the function FunctionName
+  static void store(const std::string &Key,
+                    const std::vector<clang::FunctionDecl *> &Traversals,
+                    TraversalSynthesizer *Synthesizer,
+                    const std::string &FunctionName);
+
+  /// Print the number of hits and misses
+  static void printStatistics(llvm::raw_ostream &OS);
+};
+
+#endif
@@ -0,0 +1,263 @@
+//===--- FusionPlanner.cpp ------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//===----------------------------------------------------------------------===//
+
+#include "FusionPlanner.h"
+#include "FunctionsFinder.h"
+#include "FusionProfile.h"
+#include <algorithm>
+#include <set>
+
+#define DEBUG_TYPE "fusion-planner"
+
+extern llvm::cl::OptionCategory TreeFuserCategory;
+
+namespace opts {
+extern llvm::cl::opt<unsigned> MaxMergedInstances;
+extern llvm::cl::opt<unsigned> MaxMergedNodes;
+
+llvm::cl::opt<FusionStrategy> Strategy(
+    "fusion-strategy", cl::desc("the search used to choose the merged calls"),
+    cl::values(clEnumValN(FS_Greedy, "greedy",
+                          "merge calls in order whenever it is legal"),
+               clEnumValN(FS_Beam, "beam",
+                          "beam search guided by the cost model"),
+               clEnumValN(FS_Exhaustive, "exhaustive",
+                          "branch and bound search guided by the cost model")),
+    cl::init(FS_Greedy), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<unsigned>
+    BeamWidth("fusion-beam-width",
+              cl::desc("number of plans kept by the beam search"),
+              cl::init(8), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<unsigned> TimeBudget(
+    "fusion-time-budget",
+    cl::desc("time budget in milliseconds of the beam and exhaustive searches "
+             "for each dependence graph"),
+    cl::init(2000), cl::Optional, cl::cat(TreeFuserCategory));
+} // namespace opts
+
+/// Weights of the cost model, a merge saves one visit of the child subtree,
+/// each traversal in a synthesized function adds a truncate flag that is
+/// tested in each of its blocks, and each statement adds to its size
+static const double VisitWeight = 1.0;
+static const double FlagWeight = 0.1;
+static const double CodeSizeWeight = 0.005;
+
+FusionPlanner::FusionPlanner(DependenceGraph *DepGraph_) : DepGraph(DepGraph_) {
+  ProfileKey = FusionProfile::getFunctionKey(DepGraph->getTraversals());
+}
+
+void FusionPlanner::collectActions() {
+  // group calls by the child they visit in the order of first appearance
+  std::vector<clang::FieldDecl *> Children;
+  std::unordered_map<clang::FieldDecl *, std::vector<DG_Node *>> ChildToCallers;
+  for (auto *Node : DepGraph->getNodes()) {
+    if (!Node->getStatementInfo()->isCallStmt())
+      continue;
+    auto *Child = Node->getStatementInfo()->getCalledChild();
+    if (!ChildToCallers.count(Child))
+      Children.push_back(Child);
+    ChildToCallers[Child].push_back(Node);
+  }
+
+  for (auto *Child : Children) {
+    auto &CallNodes = ChildToCallers[Child];
+    LLVM_DEBUG(outs() << Child->getNameAsString() << ":" << CallNodes.size()
+                      << "\n");
+    for (int i = 0; i < CallNodes.size(); i++)
+      for (int j = i + 1; j < CallNodes.size(); j++)
+        Actions.push_back({CallNodes[i], CallNodes[j]});
+  }
+
+  // consider merges of calls that are often active together first
+  if (FusionProfile::isAvailable()) {
+    std::stable_sort(Actions.begin(), Actions.end(),
+                     [&](const MergeAction &A, const MergeAction &B) {
+                       return FusionProfile::getSharedCount(
+                                  ProfileKey, A.First, A.Second) >
+                              FusionProfile::getSharedCount(
+                                  ProfileKey, B.First, B.Second);
+                     });
+  }
+}
+
+bool FusionPlanner::applyAction(const MergeAction &Action) {
+  if (Action.Second->isMerged())
+    return false;
+
+  // merging calls on cold paths only adds truncate flags checks
+  if (FusionProfile::isUnprofitableMerge(ProfileKey, Action.First,
+                                         Action.Second))
+    return false;
+
+  // rejects merges that form a cycle without modifying the graph
+  if (!DepGraph->tryMerge(Action.First, Action.Second))
+    return false;
+
+  auto ReachMaxMerged = [&](MergeInfo *Info) {
+    unordered_map<FunctionDecl *, int> Counter;
+    for (auto *Node : Info->MergedNodes) {
+      auto Count = ++Counter[Node->getStatementInfo()
+                                 ->getCalledFunction()
+                                 ->getDefinition()];
+      if (Count > opts::MaxMergedInstances)
+        return true;
+    }
+    return false;
+  };
+
+  auto *Info = Action.First->getMergeInfo();
+  if (Info->MergedNodes.size() > opts::MaxMergedNodes ||
+      ReachMaxMerged(Info) || DepGraph->hasWrongFuse(Info)) {
+    LLVM_DEBUG(outs() << "rollback on merge, " << DepGraph->hasWrongFuse(Info)
+                      << "\n");
+    DepGraph->unmerge(Action.Second);
+    return false;
+  }
+  return true;
+}
+
+unsigned FusionPlanner::getCalleeSize(DG_Node *CallNode) {
+  auto *Callee = CallNode->getStatementInfo()->getCalledFunction();
+  if (!Callee || !Callee->getDefinition() ||
+      !FunctionsFinder::hasFunctionInfo(Callee->getDefinition()))
+    return 1;
+  return FunctionsFinder::getFunctionInfo(Callee->getDefinition())
+      ->getStatements()
+      .size();
+}
+
+double FusionPlanner::evaluate() {
+  unsigned VisitsSaved = 0, LiveFlags = 0, CodeSize = 0;
+  std::set<MergeInfo *> Visited;
+  for (auto *Node : DepGraph->getNodes()) {
+    if (!Node->isMerged() || !Visited.insert(Node->getMergeInfo()).second)
+      continue;
+    auto &MergedNodes = Node->getMergeInfo()->MergedNodes;
+    VisitsSaved += MergedNodes.size() - 1;
+    LiveFlags += MergedNodes.size();
+    for (auto *MergedNode : MergedNodes)
+      CodeSize += getCalleeSize(MergedNode);
+  }
+  return VisitWeight * VisitsSaved - FlagWeight * LiveFlags -
+         CodeSizeWeight * CodeSize;
+}
+
+void FusionPlanner::replay(const std::vector<unsigned> &Plan) {
+  DepGraph->unmergeAll();
+  for (unsigned ActionIndex : Plan) {
+    bool Applied = applyAction(Actions[ActionIndex]);
+    (void)Applied;
+    assert(Applied && "replayed merge must be legal");
+  }
+}
+
+void FusionPlanner::completeGreedily(unsigned From,
+                                     std::vector<unsigned> &Plan) {
+  for (unsigned i = From; i < Actions.size(); i++)
+    if (applyAction(Actions[i]))
+      Plan.push_back(i);
+}
+
+void FusionPlanner::planGreedy() {
+  std::vector<unsigned> Plan;
+  completeGreedily(0, Plan);
+}
+
+void FusionPlanner::planBeam() {
+  struct PlanState {
+    std::vector<unsigned> Plan;
+    double Score;
+  };
+
+  std::vector<PlanState> Beam = {{{}, 0}};
+  unsigned Index = 0;
+  for (; Index < Actions.size() && !isOutOfTime(); Index++) {
+    std::vector<PlanState> Next;
+    for (auto &State : Beam) {
+      replay(State.Plan);
+      if (applyAction(Actions[Index])) {
+        PlanState Extended = State;
+        Extended.Plan.push_back(Index);
+        Extended.Score = evaluate();
+        Next.push_back(Extended);
+      }
+      Next.push_back(State);
+    }
+    std::stable_sort(Next.begin(), Next.end(),
+                     [](const PlanState &A, const PlanState &B) {
+                       return A.Score > B.Score;
+                     });
+    if (Next.size() > opts::BeamWidth)
+      Next.resize(opts::BeamWidth);
+    Beam = Next;
+  }
+
+  // the best plan is completed greedily if the search ran out of time
+  auto Best = Beam.front().Plan;
+  replay(Best);
+  completeGreedily(Index, Best);
+}
+
+void FusionPlanner::searchExhaustive(unsigned Index, double Score,
+                                     std::vector<unsigned> &Plan) {
+  // each remaining merge saves at most one visit
+  if (Score + VisitWeight * (Actions.size() - Index) <= BestScore ||
+      isOutOfTime())
+    return;
+
+  if (Index == Actions.size()) {
+    BestScore = Score;
+    BestPlan = Plan;
+    return;
+  }
+
+  if (applyAction(Actions[Index])) {
+    Plan.push_back(Index);
+    searchExhaustive(Index + 1, evaluate(), Plan);
+    Plan.pop_back();
+    DepGraph->unmerge(Actions[Index].Second);
+  }
+  searchExhaustive(Index + 1, Score, Plan);
+}
+
+void FusionPlanner::planExhaustive() {
+  // start from the greedy plan so that running out of time still gives a
+  // reasonable result
+  BestPlan.clear();
+  completeGreedily(0, BestPlan);
+  BestScore = evaluate();
+
+  DepGraph->unmergeAll();
+  std::vector<unsigned> Plan;
+  searchExhaustive(0, evaluate(), Plan);
+
+  replay(BestPlan);
+}
+
+void FusionPlanner::plan() {
+  collectActions();
+  Deadline = std::chrono::steady_clock::now() +
+             std::chrono::milliseconds(opts::TimeBudget);
+
+  switch (opts::Strategy) {
+  case FS_Greedy:
+    planGreedy();
+    break;
+  case FS_Beam:
+    planBeam();
+    break;
+  case FS_Exhaustive:
+    planExhaustive();
+    break;
+  }
+  LLVM_DEBUG(outs() << "fusion plan score: " << evaluate() << "\n");
+}
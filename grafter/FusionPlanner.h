@@ -0,0 +1,89 @@
+//===--- FusionPlanner.h --------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// This class decides which call nodes of a dependence graph are merged. Each
+// possible merge is a pair of calls to the same child, the planner searches
+// for the set of legal merges that maximizes a cost model that accounts for
+// node visits saved, truncate flags of the synthesized traversals and their
+// code size.
+//===----------------------------------------------------------------------===//
+
+#ifndef TREE_FUSER_FUSION_PLANNER
+#define TREE_FUSER_FUSION_PLANNER
+
+#include "DependenceGraph.h"
+#include "LLVMDependencies.h"
+#include <chrono>
+#include <vector>
+
+enum FusionStrategy { FS_Greedy, FS_Beam, FS_Exhaustive };
+
+/// Merge the call node Second into the merged set of the call node First
+struct MergeAction {
+  DG_Node *First;
+  DG_Node *Second;
+};
+
+class FusionPlanner {
+private:
+  DependenceGraph *DepGraph;
+
+  /// Identifies the synthesized function of the graph in the fusion profile
+  std::string ProfileKey;
+
+  /// All possible merges, ordered by the order of first appearance of the
+  /// visited child and then by the original order of the calls
+  std::vector<MergeAction> Actions;
+
+  /// The time after which the search stops and returns the best plan found
+  std::chrono::steady_clock::time_point Deadline;
+
+  /// The best plan found by the exhaustive search and its score
+  std::vector<unsigned> BestPlan;
+  double BestScore;
+
+  /// Collect the merge actions of the graph
+  void collectActions();
+
+  /// Perform a merge if it is legal and does not exceed the merge limits,
+  /// return false and leave the graph unchanged otherwise
+  bool applyAction(const MergeAction &Action);
+
+  /// Return the score of the merges currently performed on the graph
+  double evaluate();
+
+  /// Return the number of statements of the function called by a call node
+  unsigned getCalleeSize(DG_Node *CallNode);
+
+  /// Undo all merges then perform the merges of the plan in order
+  void replay(const std::vector<unsigned> &Plan);
+
+  /// Apply each action that can be applied starting from the given index
+  void completeGreedily(unsigned From, std::vector<unsigned> &Plan);
+
+  bool isOutOfTime() const {
+    return std::chrono::steady_clock::now() > Deadline;
+  }
+
+  void planGreedy();
+
+  void planBeam();
+
+  void planExhaustive();
+
+  void searchExhaustive(unsigned Index, double Score,
+                        std::vector<unsigned> &Plan);
+
+public:
+  FusionPlanner(DependenceGraph *DepGraph_);
+
+  /// Merge the call nodes of the graph using the selected strategy
+  void plan();
+};
+
+#endif
@@ -0,0 +1,196 @@
+//===--- FusionProfile.cpp ------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//===----------------------------------------------------------------------===//
+
+#include "FusionProfile.h"
+#include "DependenceGraph.h"
+#include "Logger.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#define DEBUG_TYPE "fusion-profile"
+
+extern llvm::cl::OptionCategory TreeFuserCategory;
+
+namespace opts {
+llvm::cl::opt<std::string>
+    ProfileFile("fusion-profile",
+                cl::desc("profile produced by a program transformed with "
+                         "-fusion-instrument"),
+                cl::init(""), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<unsigned> ProfileColdThreshold(
+    "fusion-profile-cold-threshold",
+    cl::desc("calls executed fewer times than this are not merged"),
+    cl::init(100), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<unsigned> ProfileMinShared(
+    "fusion-profile-min-shared",
+    cl::desc("minimum percentage of the executions of a call in which "
+             "another call must be active for them to be merged"),
+    cl::init(10), cl::Optional, cl::cat(TreeFuserCategory));
+} // namespace opts
+
+std::map<std::pair<std::string, std::string>, std::map<unsigned, unsigned long>>
+    FusionProfile::Histograms;
+
+bool FusionProfile::load() {
+  auto Buffer = llvm::MemoryBuffer::getFile(opts::ProfileFile);
+  if (!Buffer)
+    return Logger::getStaticLogger().logError(
+        "cannot read fusion profile " + opts::ProfileFile);
+
+  // each line is: function key, node ids, flags, count (tab separated), the
+  // counts of repeated entries are summed
+  SmallVector<StringRef, 64> Lines;
+  Buffer.get()->getBuffer().split(Lines, '\n', -1, false);
+  for (auto Line : Lines) {
+    SmallVector<StringRef, 4> Fields;
+    Line.split(Fields, '\t');
+    unsigned Flags;
+    unsigned long Count;
+    if (Fields.size() != 4 || Fields[2].getAsInteger(10, Flags) ||
+        Fields[3].getAsInteger(10, Count)) {
+      Logger::getStaticLogger().logWarn("ignoring malformed profile line: " +
+                                        Line.str());
+      continue;
+    }
+
+    SmallVector<StringRef, 8> NodeIds;
+    Fields[1].split(NodeIds, ',');
+    for (auto NodeId : NodeIds)
+      Histograms[std::make_pair(Fields[0].str(), NodeId.str())][Flags] +=
+          Count;
+  }
+  Logger::getStaticLogger().logInfo("loaded fusion profile with " +
+                                    to_string(Histograms.size()) + " sites");
+  return true;
+}
+
+bool FusionProfile::isAvailable() {
+  if (opts::ProfileFile.empty())
+    return false;
+  // loaded once, also when the contexts are transformed concurrently
+  static bool Loaded = (load(), true);
+  (void)Loaded;
+  return !Histograms.empty();
+}
+
+std::string FusionProfile::getFunctionKey(
+    const std::vector<clang::FunctionDecl *> &Traversals) {
+  std::string Key;
+  for (auto *Traversal : Traversals)
+    Key += (Key.empty() ? "" : ",") + Traversal->getQualifiedNameAsString() +
+           "/" + to_string(Traversal->getNumParams());
+  return Key;
+}
+
+std::string FusionProfile::getNodeId(DG_Node *Node) {
+  return to_string(Node->getTraversalId()) + "." +
+         to_string(Node->getStatementInfo()->getStatementId());
+}
+
+bool FusionProfile::getCallCounts(const std::string &FunctionKey,
+                                  DG_Node *First, DG_Node *Second,
+                                  unsigned long &Executions,
+                                  unsigned long &Shared) {
+  auto It = Histograms.find(std::make_pair(FunctionKey, getNodeId(First)));
+  if (It == Histograms.end())
+    return false;
+
+  unsigned FirstBit = 1 << First->getTraversalId();
+  unsigned SecondBit = 1 << Second->getTraversalId();
+  Executions = Shared = 0;
+  for (auto &Entry : It->second) {
+    if (!(Entry.first & FirstBit))
+      continue;
+    Executions += Entry.second;
+    if (Entry.first & SecondBit)
+      Shared += Entry.second;
+  }
+  return true;
+}
+
+bool FusionProfile::isUnprofitableMerge(const std::string &FunctionKey,
+                                        DG_Node *First, DG_Node *Second) {
+  unsigned long Executions, Shared;
+  if (!isAvailable() ||
+      !getCallCounts(FunctionKey, First, Second, Executions, Shared))
+    return false;
+
+  LLVM_DEBUG(outs() << "profile of " << getNodeId(First) << " with "
+                    << getNodeId(Second) << ": " << Shared << "/"
+                    << Executions << "\n");
+
+  return Executions < opts::ProfileColdThreshold ||
+         Shared * 100 < Executions * opts::ProfileMinShared;
+}
+
+unsigned long FusionProfile::getSharedCount(const std::string &FunctionKey,
+                                            DG_Node *First, DG_Node *Second) {
+  unsigned long Executions, Shared;
+  if (!isAvailable() ||
+      !getCallCounts(FunctionKey, First, Second, Executions, Shared))
+    return 0;
+  return Shared;
+}
+
+std::string FusionProfile::getRuntimeText() {
+  return R"(
+#ifndef _GRAFTER_PROFILE_RUNTIME
+#define _GRAFTER_PROFILE_RUNTIME
+#include <cstdio>
+#include <cstdlib>
+struct _GrafterProfileSite {
+  const char *Function;
+  const char *Nodes;
+  unsigned Size;
+  unsigned long *Counts;
+  _GrafterProfileSite *Next;
+  static _GrafterProfileSite *&head() {
+    static _GrafterProfileSite *Head = nullptr;
+    return Head;
+  }
+  static void write() {
+    const char *FileName = getenv("GRAFTER_PROFILE");
+    FILE *File = fopen(FileName ? FileName : "grafter.profile", "a");
+    if (!File)
+      return;
+    for (_GrafterProfileSite *Site = head(); Site; Site = Site->Next)
+      for (unsigned Flags = 0; Flags < Site->Size; Flags++)
+        if (Site->Counts[Flags])
+          fprintf(File, "%s\t%s\t%u\t%lu\n", Site->Function, Site->Nodes,
+                  Flags, Site->Counts[Flags]);
+    fclose(File);
+  }
+  _GrafterProfileSite(const char *Function, const char *Nodes, unsigned Width)
+      : Function(Function), Nodes(Nodes), Size(1u << Width),
+        Counts((unsigned long *)calloc(1u << Width, sizeof(unsigned long))),
+        Next(head()) {
+    if (!Next)
+      atexit(write);
+    head() = this;
+  }
+  void record(unsigned int Flags) { Counts[Flags & (Size - 1)]++; }
+};
+#endif
+)";
+}
+
+std::string FusionProfile::getSiteText(const std::string &FunctionKey,
+                                       const std::string &SiteName,
+                                       const std::vector<std::string> &NodeIds,
+                                       unsigned TraversalsCount) {
+  std::string Nodes;
+  for (auto &NodeId : NodeIds)
+    Nodes += (Nodes.empty() ? "" : ",") + NodeId;
+
+  return "static _GrafterProfileSite " + SiteName + "(\"" + FunctionKey +
+         "\", \"" + Nodes + "\", " + to_string(TraversalsCount) + ");\n" +
+         SiteName + ".record(truncate_flags);\n";
+}
@@ -0,0 +1,80 @@
+//===--- FusionProfile.h --------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Support for profile guided fusion. With -fusion-instrument the synthesized
+// traversals record, for their entry and for each of their call parts, how
+// many times they were executed with each value of the truncate flags. The
+// resulting profile is read with -fusion-profile and used by the fusion
+// planner to prioritize hot call sites and to skip merges of calls that are
+// rarely active together.
+//
+// A site is identified by the participating traversals of the synthesized
+// function (see getFunctionKey) and by the (traversal index, statement id)
+// of the call nodes of the call part, or "entry" for the function entry.
+//===----------------------------------------------------------------------===//
+
+#ifndef TREE_FUSER_FUSION_PROFILE
+#define TREE_FUSER_FUSION_PROFILE
+
+#include "LLVMDependencies.h"
+#include <map>
+#include <string>
+#include <vector>
+
+class DG_Node;
+
+class FusionProfile {
+private:
+  /// Maps a function key and a node id to the histogram of truncate flags
+  static std::map<std::pair<std::string, std::string>,
+                  std::map<unsigned, unsigned long>>
+      Histograms;
+
+  /// Read the profile file given by -fusion-profile
+  static bool load();
+
+public:
+  /// Return true if a profile is available (loads it on first use)
+  static bool isAvailable();
+
+  /// Return the key identifying a synthesized function by its participating
+  /// traversals
+  static std::string
+  getFunctionKey(const std::vector<clang::FunctionDecl *> &Traversals);
+
+  /// Return the id of a call node within its synthesized function
+  static std::string getNodeId(DG_Node *Node);
+
+  /// Return the number of times the call of First executed, and in how many
+  /// of them the call of Second was active too. Return false if the profile
+  /// has no record of First
+  static bool getCallCounts(const std::string &FunctionKey, DG_Node *First,
+                            DG_Node *Second, unsigned long &Executions,
+                            unsigned long &Shared);
+
+  /// Return true if merging the calls of two nodes is not profitable
+  /// according to the profile (cold, or rarely active together)
+  static bool isUnprofitableMerge(const std::string &FunctionKey,
+                                  DG_Node *First, DG_Node *Second);
+
+  /// Return the number of executions in which the calls of both nodes were
+  /// active, zero if unknown
+  static unsigned long getSharedCount(const std::string &FunctionKey,
+                                      DG_Node *First, DG_Node *Second);
+
+  /// Return the code of the profiling runtime inserted once per file
+  static std::string getRuntimeText();
+
+  /// Return the code that records the truncate flags at a site
+  static std::string getSiteText(const std::string &FunctionKey,
+                                 const std::string &SiteName,
+                                 const std::vector<std::string> &NodeIds,
+                                 unsigned TraversalsCount);
+};
+
+#endif
@@ -12,7 +12,6 @@
 
 #include <ctime>
 #include <iostream>
-Logger *Logger::staticLogger = nullptr;
 
 Logger::Logger(int mode_, string fileName_, string header_) {
   this->mode = mode_;
@@ -30,6 +29,7 @@ Logger::~Logger() {
 }
 
 void Logger::log(string s) {
+  std::lock_guard<std::mutex> Guard(Lock);
 
   if (this->mode == _LOGGER_FILE_MODE || this->mode == _LOGGER_HYBRID_MODE)
     this->file << this->header + ":"
@@ -40,6 +40,7 @@ void Logger::log(string s) {
 }
 
 bool Logger::logError(string s) {
+  std::lock_guard<std::mutex> Guard(Lock);
 
   if (this->mode == _LOGGER_FILE_MODE || this->mode == _LOGGER_HYBRID_MODE)
     this->file << "Error :" << this->header + ":"
@@ -51,6 +52,7 @@ bool Logger::logError(string s) {
   return  false; 
 }
 void Logger::logInfo(string s) {
+  std::lock_guard<std::mutex> Guard(Lock);
   if (this->mode == _LOGGER_FILE_MODE || this->mode == _LOGGER_HYBRID_MODE)
     this->file << "Info :" << this->header + ":"
                << "\t" << s << endl;
@@ -60,6 +62,7 @@ void Logger::logInfo(string s) {
 }
 
 void Logger::logDebug(string s) {
+  std::lock_guard<std::mutex> Guard(Lock);
 
   if (this->mode == _LOGGER_FILE_MODE || this->mode == _LOGGER_HYBRID_MODE)
     this->file << "Debug :" << this->header + ":"
@@ -70,6 +73,7 @@ void Logger::logDebug(string s) {
          << " :\t" << s << endl;
 }
 void Logger::logWarn(string s) {
+  std::lock_guard<std::mutex> Guard(Lock);
 
   if (this->mode == _LOGGER_FILE_MODE || this->mode == _LOGGER_HYBRID_MODE)
     this->file << "Warn :" << this->header + ":"
@@ -81,13 +85,13 @@ void Logger::logWarn(string s) {
 }
 
 Logger &Logger::getStaticLogger() {
-  if (staticLogger == nullptr) {
+  // a local static is initialized once, even by concurrent callers
+  static Logger *StaticLogger = [] {
     std::time_t result = std::time(nullptr);
 
     string timeSlot = std::ctime(&result);
-    staticLogger =
-        new Logger(_LOGGER_STDOUT_MODE, ("./T_" + timeSlot + ".txt"));
-  }
+    return new Logger(_LOGGER_STDOUT_MODE, ("./T_" + timeSlot + ".txt"));
+  }();
 
-  return *staticLogger;
+  return *StaticLogger;
 }
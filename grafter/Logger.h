@@ -13,6 +13,7 @@
 
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <string>
 
 #define _LOGGER_FILE_MODE 1
@@ -28,7 +29,8 @@ private:
   string header;
   int mode;
   ofstream file;
-  static Logger *staticLogger;
+  /// Keeps the lines of concurrent writers apart
+  std::mutex Lock;
 
 public:
   Logger(int mode_, string fileName_, string header = "");
@@ -0,0 +1,45 @@
+//===--- MemoryArena.cpp --------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//===----------------------------------------------------------------------===//
+
+#include "MemoryArena.h"
+#include "llvm/Support/Process.h"
+
+std::atomic<unsigned long> MemoryStatistics::GraphsCreated(0);
+std::atomic<unsigned long> MemoryStatistics::GraphsLive(0);
+std::atomic<unsigned long> MemoryStatistics::GraphNodes(0);
+std::atomic<unsigned long> MemoryStatistics::MergeInfosAllocated(0);
+std::atomic<unsigned long> MemoryStatistics::MergeInfosReused(0);
+std::atomic<unsigned long> MemoryStatistics::AutomataCreated(0);
+std::atomic<unsigned long> MemoryStatistics::AutomataLive(0);
+
+void *MemoryArena::allocate(size_t Size, size_t Alignment) {
+  llvm::sys::SmartScopedLock<true> Guard(Lock);
+  ObjectsCount++;
+  return Allocator.Allocate(Size, Alignment);
+}
+
+MemoryArena &MemoryArena::getAnalysisArena() {
+  static MemoryArena AnalysisArena;
+  return AnalysisArena;
+}
+
+void MemoryStatistics::print(llvm::raw_ostream &OS) {
+  auto &Arena = MemoryArena::getAnalysisArena();
+  OS << "INFO: memory: analysis arena " << Arena.getBytesAllocated()
+     << " bytes in " << Arena.getObjectsCount() << " objects\n";
+  OS << "INFO: memory: " << GraphsCreated << " dependence graphs ("
+     << GraphsLive << " live), " << GraphNodes << " nodes, "
+     << MergeInfosAllocated << " merge infos allocated and "
+     << MergeInfosReused << " reused\n";
+  OS << "INFO: memory: " << AutomataCreated << " automata created ("
+     << AutomataLive << " live)\n";
+  OS << "INFO: memory: malloc usage " << llvm::sys::Process::GetMallocUsage()
+     << " bytes\n";
+}
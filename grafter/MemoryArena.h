@@ -0,0 +1,69 @@
+//===--- MemoryArena.h ----------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Bump pointer allocation of the analysis objects. Access paths and statement
+// information live as long as the run and are allocated from the analysis
+// arena, the nodes and the merge information of a dependence graph are
+// allocated by the graph and released together with it.
+//===----------------------------------------------------------------------===//
+
+#ifndef TREE_FUSER_MEMORY_ARENA
+#define TREE_FUSER_MEMORY_ARENA
+
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <cstddef>
+
+class MemoryArena {
+private:
+  llvm::BumpPtrAllocator Allocator;
+
+  /// Objects are created concurrently with -j and -parallel-tu
+  llvm::sys::SmartMutex<true> Lock;
+
+  unsigned long ObjectsCount = 0;
+
+public:
+  void *allocate(size_t Size, size_t Alignment);
+
+  size_t getBytesAllocated() const { return Allocator.getBytesAllocated(); }
+
+  unsigned long getObjectsCount() const { return ObjectsCount; }
+
+  /// Return the arena of the objects that live as long as the run
+  static MemoryArena &getAnalysisArena();
+};
+
+/// Base of the classes whose objects are allocated from the analysis arena,
+/// delete runs the destructor and the memory is released at the end of the
+/// run
+struct ArenaAllocated {
+  static void *operator new(size_t Size) {
+    return MemoryArena::getAnalysisArena().allocate(
+        Size, alignof(std::max_align_t));
+  }
+
+  static void operator delete(void *) {}
+};
+
+/// Counters reported by -print-memory-stats
+struct MemoryStatistics {
+  static std::atomic<unsigned long> GraphsCreated;
+  static std::atomic<unsigned long> GraphsLive;
+  static std::atomic<unsigned long> GraphNodes;
+  static std::atomic<unsigned long> MergeInfosAllocated;
+  static std::atomic<unsigned long> MergeInfosReused;
+  static std::atomic<unsigned long> AutomataCreated;
+  static std::atomic<unsigned long> AutomataLive;
+
+  static void print(llvm::raw_ostream &OS);
+};
+
+#endif
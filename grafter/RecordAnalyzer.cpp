@@ -11,6 +11,7 @@
 
 #include "RecordAnalyzer.h"
 #include "Logger.h"
+#include "llvm/Support/Mutex.h"
 #include <set>
 #include <stack>
 
@@ -21,11 +22,28 @@ std::unordered_map<const clang::CXXRecordDecl *,
         std::unordered_map<const clang::CXXRecordDecl *,
                            std::vector<const clang::CXXRecordDecl *>>();
 
+/// Guards the type hierarchy, records of several contexts are analyzed
+/// concurrently with -parallel-tu
+static llvm::sys::SmartMutex<true> DerivedRecordsLock;
+
+void RecordsAnalyzer::registerContext(clang::ASTContext *Ctx) {
+  RecordsInfoGlobalStore[Ctx];
+}
+
+const std::vector<const clang::CXXRecordDecl *> &
+RecordsAnalyzer::getDerivedRecords(const clang::CXXRecordDecl *RecordDecl) {
+  static const std::vector<const clang::CXXRecordDecl *> NoDerivedRecords;
+  auto It = DerivedRecords.find(RecordDecl);
+  if (It == DerivedRecords.end())
+    return NoDerivedRecords;
+  return It->second;
+}
+
 const set<clang::FieldDecl *> &
 RecordsAnalyzer::getRecursiveFields(const clang::RecordDecl *RecordDecl) {
   ASTContext *Ctx = &RecordDecl->getASTContext();
   auto *RecordDeclInfo =
-      RecordsAnalyzer::RecordsInfoGlobalStore[Ctx][RecordDecl];
+      RecordsAnalyzer::RecordsInfoGlobalStore.at(Ctx)[RecordDecl];
   assert(RecordDeclInfo->IsTreeStructure);
   return RecordDeclInfo->getRecursiveFields();
 }
@@ -33,7 +51,7 @@ RecordsAnalyzer::getRecursiveFields(const clang::RecordDecl *RecordDecl) {
 const RecordInfo &
 RecordsAnalyzer::getRecordInfo(const clang::RecordDecl *RecordDecl) {
   ASTContext *Ctx = &RecordDecl->getASTContext();
-  return *RecordsAnalyzer::RecordsInfoGlobalStore[Ctx][RecordDecl];
+  return *RecordsAnalyzer::RecordsInfoGlobalStore.at(Ctx)[RecordDecl];
 }
 
 bool RecordsAnalyzer::isCompleteScaler(clang::ValueDecl *const Decl) {
@@ -46,7 +64,8 @@ bool RecordsAnalyzer::isCompleteScaler(clang::ValueDecl *const Decl) {
   auto *Ctx = &Decl->getASTContext();
 
   auto *RecordDecl = Decl->getType()->getAsCXXRecordDecl();
-  auto *RecordInfo = RecordsAnalyzer::RecordsInfoGlobalStore[Ctx][RecordDecl];
+  auto *RecordInfo =
+      RecordsAnalyzer::RecordsInfoGlobalStore.at(Ctx)[RecordDecl];
 
   if (RecordInfo && RecordInfo->IsCompleteScaler != -1)
     return RecordInfo->IsCompleteScaler;
@@ -75,14 +94,15 @@ bool RecordsAnalyzer::VisitCXXRecordDecl(
   RecordInfo *RecordInformation = new RecordInfo();
   ASTContext *Ctx = &RecordDecl->getASTContext();
 
-  if (RecordsAnalyzer::RecordsInfoGlobalStore[Ctx].count(RecordDecl) &&
-      RecordsAnalyzer::RecordsInfoGlobalStore[Ctx][RecordDecl]) {
+  if (RecordsAnalyzer::RecordsInfoGlobalStore.at(Ctx).count(RecordDecl) &&
+      RecordsAnalyzer::RecordsInfoGlobalStore.at(Ctx)[RecordDecl]) {
     Logger::getStaticLogger().logWarn(
         "RecordsAnalyzer::VisitCXXRecordDecl : record already analyzed");
     return true;
   }
 
-  RecordsAnalyzer::RecordsInfoGlobalStore[Ctx][RecordDecl] = RecordInformation;
+  RecordsAnalyzer::RecordsInfoGlobalStore.at(Ctx)[RecordDecl] =
+      RecordInformation;
 
   if (!hasTreeAnnotation(RecordDecl)) {
     RecordInformation->IsTreeStructure = false;
@@ -150,15 +170,16 @@ bool RecordsAnalyzer::VisitCXXRecordDecl(
 
     for (auto &BaseClass : TopOfStack->bases()) {
       Stack.push(BaseClass.getType()->getAsCXXRecordDecl());
+      llvm::sys::SmartScopedLock<true> Guard(DerivedRecordsLock);
       DerivedRecords[BaseClass.getType()->getAsCXXRecordDecl()].push_back(
           RecordDecl);
     }
 
-    if (!RecordsAnalyzer::RecordsInfoGlobalStore[Ctx].count(TopOfStack))
+    if (!RecordsAnalyzer::RecordsInfoGlobalStore.at(Ctx).count(TopOfStack))
       VisitCXXRecordDecl(TopOfStack);
 
     auto *BaseRecordInfo =
-        RecordsAnalyzer::RecordsInfoGlobalStore[Ctx][TopOfStack];
+        RecordsAnalyzer::RecordsInfoGlobalStore.at(Ctx)[TopOfStack];
 
     if (!BaseRecordInfo->isTreeStructure())
       continue;
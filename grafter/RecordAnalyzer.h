@@ -63,6 +63,14 @@ public:
   /// Initiate an ast traversal to analyze the records source code
   void analyzeRecordsDeclarations(const clang::ASTContext &Context);
 
+  /// Create the records table of a context, all the contexts must be
+  /// registered before they are analyzed (possibly concurrently)
+  static void registerContext(clang::ASTContext *Ctx);
+
+  /// Return the records derived from the given record
+  static const std::vector<const clang::CXXRecordDecl *> &
+  getDerivedRecords(const clang::CXXRecordDecl *RecordDecl);
+
   /// Return recursive field declarations
   static const std::set<clang::FieldDecl *> &
   getRecursiveFields(const clang::RecordDecl *RecordDecl);
@@ -78,12 +86,12 @@ public:
 
   bool VisitCXXRecordDecl(const clang::CXXRecordDecl *RecordDecl);
 
-  static std::unordered_map<const clang::CXXRecordDecl *,
-                            std::vector<const clang::CXXRecordDecl *>>
-      DerivedRecords;
   // static std::vector<clang::CXXRecordDecl*> getPossibleTypes(){}
 private:
   /// Stores type hierarchy
+  static std::unordered_map<const clang::CXXRecordDecl *,
+                            std::vector<const clang::CXXRecordDecl *>>
+      DerivedRecords;
 
   /// A table that stores record information
   static std::unordered_map<
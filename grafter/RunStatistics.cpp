@@ -0,0 +1,251 @@
+//===--- RunStatistics.cpp ------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+//===----------------------------------------------------------------------===//
+
+#include "RunStatistics.h"
+#include "Logger.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include <algorithm>
+
+/// Number of candidates listed by the table report
+static const unsigned ReportedCandidates = 10;
+
+std::atomic<unsigned long> RunStatistics::PhaseNanoseconds[RP_Count];
+std::atomic<unsigned long> RunStatistics::PhaseRuns[RP_Count];
+std::atomic<unsigned long> RunStatistics::Counters[RC_Count];
+
+llvm::sys::SmartMutex<true> RunStatistics::CandidatesLock;
+std::vector<CandidateStatistics> RunStatistics::Candidates;
+thread_local CounterSet RunStatistics::ThreadCounters;
+
+const char *RunStatistics::getPhaseName(RunPhase Phase) {
+  switch (Phase) {
+  case RP_Records:
+    return "records analysis";
+  case RP_Functions:
+    return "functions analysis";
+  case RP_Candidates:
+    return "candidates finding";
+  case RP_DependenceGraph:
+    return "dependence graph";
+  case RP_Fusion:
+    return "fusion planning";
+  case RP_TopologicalOrder:
+    return "topological order";
+  case RP_Synthesis:
+    return "synthesis";
+  case RP_Rewriting:
+    return "rewriting";
+  default:
+    llvm_unreachable("unknown phase");
+  }
+}
+
+const char *RunStatistics::getCounterName(RunCounter Counter) {
+  switch (Counter) {
+  case RC_Candidates:
+    return "candidates";
+  case RC_SynthesizedFunctions:
+    return "synthesized functions";
+  case RC_GraphNodes:
+    return "dependence graph nodes";
+  case RC_IntersectionQueries:
+    return "intersection queries";
+  case RC_IntersectionsComputed:
+    return "intersections computed";
+  case RC_ProductStates:
+    return "product states explored";
+  case RC_MaxAutomataStates:
+    return "max automata states";
+  case RC_MergeAttempts:
+    return "merge attempts";
+  case RC_MergeRejections:
+    return "merges rejected";
+  case RC_Rollbacks:
+    return "merges rolled back";
+  case RC_HasCycleCalls:
+    return "hasCycle calls";
+  case RC_SharedFunctions:
+    return "shared functions";
+  case RC_ReorderedCalls:
+    return "reordered fused calls";
+  case RC_TailLoops:
+    return "tail calls to loops";
+  case RC_IterativeFunctions:
+    return "functions on an explicit stack";
+  default:
+    llvm_unreachable("unknown counter");
+  }
+}
+
+void RunStatistics::countMax(RunCounter Counter, unsigned long Value) {
+  ThreadCounters.Values[Counter] =
+      std::max(ThreadCounters.Values[Counter], Value);
+  unsigned long Current = Counters[Counter];
+  while (Current < Value &&
+         !Counters[Counter].compare_exchange_weak(Current, Value))
+    ;
+}
+
+CounterSet RunStatistics::beginThreadWork() {
+  CounterSet Start = ThreadCounters;
+  ThreadCounters.Values[RC_MaxAutomataStates] = 0;
+  return Start;
+}
+
+CounterSet RunStatistics::endThreadWork(const CounterSet &Start) {
+  CounterSet Work;
+  for (int Counter = 0; Counter < RC_Count; Counter++)
+    Work.Values[Counter] =
+        ThreadCounters.Values[Counter] - Start.Values[Counter];
+
+  // the maximum of the enclosing unit of work includes this one
+  unsigned long &Max = ThreadCounters.Values[RC_MaxAutomataStates];
+  Work.Values[RC_MaxAutomataStates] = Max;
+  Max = std::max(Max, Start.Values[RC_MaxAutomataStates]);
+  return Work;
+}
+
+void RunStatistics::addThreadWork(const CounterSet &Work) {
+  for (int Counter = 0; Counter < RC_Count; Counter++)
+    if (Counter != RC_MaxAutomataStates)
+      ThreadCounters.Values[Counter] += Work.Values[Counter];
+  unsigned long &Max = ThreadCounters.Values[RC_MaxAutomataStates];
+  Max = std::max(Max, Work.Values[RC_MaxAutomataStates]);
+}
+
+void RunStatistics::addCandidate(const CandidateStatistics &Candidate) {
+  llvm::sys::SmartScopedLock<true> Guard(CandidatesLock);
+  Candidates.push_back(Candidate);
+}
+
+thread_local PhaseTimer *PhaseTimer::Active = nullptr;
+
+PhaseTimer::PhaseTimer(RunPhase Phase, CandidateStatistics *Candidate)
+    : Phase(Phase), Candidate(Candidate), Elapsed(0), Parent(Active) {
+  Start = std::chrono::steady_clock::now();
+  if (Parent)
+    Parent->Elapsed += Start - Parent->Start;
+  Active = this;
+}
+
+PhaseTimer::~PhaseTimer() {
+  auto End = std::chrono::steady_clock::now();
+  Elapsed += End - Start;
+  RunStatistics::addPhaseTime(Phase, Elapsed.count());
+  if (Candidate)
+    Candidate->Seconds[Phase] += Elapsed.count() / 1e9;
+
+  Active = Parent;
+  if (Parent)
+    Parent->Start = End;
+}
+
+/// Return the total time spent on a candidate
+static double getTotalSeconds(const CandidateStatistics &Candidate) {
+  double Total = 0;
+  for (int Phase = 0; Phase < RP_Count; Phase++)
+    Total += Candidate.Seconds[Phase];
+  return Total;
+}
+
+void RunStatistics::print(llvm::raw_ostream &OS) {
+  OS << "===-------------------------------------------------------------===\n"
+     << "                       grafter time report\n"
+     << "===-------------------------------------------------------------===\n";
+  OS << llvm::format("  %-24s %12s %10s\n", "phase", "seconds", "runs");
+  for (int Phase = 0; Phase < RP_Count; Phase++)
+    OS << llvm::format("  %-24s %12.4f %10lu\n",
+                       getPhaseName((RunPhase)Phase),
+                       PhaseNanoseconds[Phase] / 1e9,
+                       (unsigned long)PhaseRuns[Phase]);
+
+  OS << "\n";
+  OS << llvm::format("  %-24s %12s\n", "counter", "value");
+  for (int Counter = 0; Counter < RC_Count; Counter++)
+    OS << llvm::format("  %-24s %12lu\n", getCounterName((RunCounter)Counter),
+                       (unsigned long)Counters[Counter]);
+
+  llvm::sys::SmartScopedLock<true> Guard(CandidatesLock);
+  if (Candidates.empty())
+    return;
+
+  std::vector<const CandidateStatistics *> Sorted;
+  for (auto &Candidate : Candidates)
+    Sorted.push_back(&Candidate);
+  std::sort(Sorted.begin(), Sorted.end(),
+            [](const CandidateStatistics *A, const CandidateStatistics *B) {
+              return getTotalSeconds(*A) > getTotalSeconds(*B);
+            });
+  if (Sorted.size() > ReportedCandidates)
+    Sorted.resize(ReportedCandidates);
+
+  OS << "\n  most expensive synthesized functions:\n";
+  OS << llvm::format("  %-32s %10s %8s %12s %8s %8s\n", "function", "seconds",
+                     "nodes", "intersect", "merges", "rollback");
+  for (auto *Candidate : Sorted)
+    OS << llvm::format("  %-32s %10.4f %8lu %12lu %8lu %8lu\n",
+                       Candidate->Name.c_str(), getTotalSeconds(*Candidate),
+                       Candidate->Counters[RC_GraphNodes],
+                       Candidate->Counters[RC_IntersectionsComputed],
+                       Candidate->Counters[RC_MergeAttempts],
+                       Candidate->Counters[RC_Rollbacks]);
+}
+
+/// Return a JSON string literal
+static std::string quote(const std::string &Text) {
+  std::string Out = "\"";
+  for (char C : Text) {
+    if (C == '"' || C == '\\')
+      Out += '\\';
+    Out += C;
+  }
+  return Out + "\"";
+}
+
+bool RunStatistics::writeJSON(const std::string &FileName) {
+  std::error_code EC;
+  llvm::raw_fd_ostream OS(FileName, EC, llvm::sys::fs::F_Text);
+  if (EC)
+    return Logger::getStaticLogger().logError("cannot write the time report " +
+                                              FileName + ": " + EC.message());
+
+  OS << "{\n  \"phases\": {";
+  for (int Phase = 0; Phase < RP_Count; Phase++)
+    OS << (Phase ? "," : "") << "\n    "
+       << quote(getPhaseName((RunPhase)Phase)) << ": {\"seconds\": "
+       << llvm::format("%.6f", PhaseNanoseconds[Phase] / 1e9)
+       << ", \"runs\": " << (unsigned long)PhaseRuns[Phase] << "}";
+  OS << "\n  },\n  \"counters\": {";
+  for (int Counter = 0; Counter < RC_Count; Counter++)
+    OS << (Counter ? "," : "") << "\n    "
+       << quote(getCounterName((RunCounter)Counter)) << ": "
+       << (unsigned long)Counters[Counter];
+  OS << "\n  },\n  \"candidates\": [";
+
+  llvm::sys::SmartScopedLock<true> Guard(CandidatesLock);
+  for (unsigned I = 0; I < Candidates.size(); I++) {
+    auto &Candidate = Candidates[I];
+    OS << (I ? "," : "") << "\n    {\"name\": " << quote(Candidate.Name)
+       << ", \"seconds\": {";
+    for (int Phase = 0; Phase < RP_Count; Phase++)
+      OS << (Phase ? ", " : "") << quote(getPhaseName((RunPhase)Phase))
+         << ": " << llvm::format("%.6f", Candidate.Seconds[Phase]);
+    OS << "}, \"counters\": {";
+    for (int Counter = 0; Counter < RC_Count; Counter++)
+      OS << (Counter ? ", " : "") << quote(getCounterName((RunCounter)Counter))
+         << ": " << Candidate.Counters[Counter];
+    OS << "}}";
+  }
+  OS << "\n  ]\n}\n";
+  return true;
+}
@@ -0,0 +1,148 @@
+//===--- RunStatistics.h --------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Time spent in each phase of a run and counters of the work done, reported
+// with -time-report (a table) and -time-report-json=<file>.
+//
+// The phases that run for each candidate are timed on the thread that runs
+// them, with -parallel-tu their times are summed over the threads. The work
+// of a synthesized function is counted by the thread that generates it, it
+// includes the functions generated for its calls and the work of the helper
+// threads of -j, but not the work of concurrent candidates (-parallel-tu).
+//===----------------------------------------------------------------------===//
+
+#ifndef TREE_FUSER_RUN_STATISTICS
+#define TREE_FUSER_RUN_STATISTICS
+
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/raw_ostream.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+enum RunPhase {
+  RP_Records,
+  RP_Functions,
+  RP_Candidates,
+  RP_DependenceGraph,
+  RP_Fusion,
+  RP_TopologicalOrder,
+  RP_Synthesis,
+  RP_Rewriting,
+  RP_Count
+};
+
+enum RunCounter {
+  RC_Candidates,
+  RC_SynthesizedFunctions,
+  RC_GraphNodes,
+  RC_IntersectionQueries,
+  RC_IntersectionsComputed,
+  RC_ProductStates,
+  RC_MaxAutomataStates,
+  RC_MergeAttempts,
+  RC_MergeRejections,
+  RC_Rollbacks,
+  RC_HasCycleCalls,
+  RC_SharedFunctions,
+  RC_ReorderedCalls,
+  RC_TailLoops,
+  RC_IterativeFunctions,
+  RC_Count
+};
+
+/// The counters of the work done by a thread
+struct CounterSet {
+  unsigned long Values[RC_Count] = {};
+};
+
+/// The work done for one synthesized function
+struct CandidateStatistics {
+  std::string Name;
+  double Seconds[RP_Count] = {};
+  unsigned long Counters[RC_Count] = {};
+};
+
+class RunStatistics {
+private:
+  static std::atomic<unsigned long> PhaseNanoseconds[RP_Count];
+  static std::atomic<unsigned long> PhaseRuns[RP_Count];
+  static std::atomic<unsigned long> Counters[RC_Count];
+
+  static llvm::sys::SmartMutex<true> CandidatesLock;
+  static std::vector<CandidateStatistics> Candidates;
+
+  /// The work counted by the calling thread
+  static thread_local CounterSet ThreadCounters;
+
+public:
+  static const char *getPhaseName(RunPhase Phase);
+
+  static const char *getCounterName(RunCounter Counter);
+
+  static void addPhaseTime(RunPhase Phase, unsigned long Nanoseconds) {
+    PhaseNanoseconds[Phase].fetch_add(Nanoseconds, std::memory_order_relaxed);
+    PhaseRuns[Phase].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  static void count(RunCounter Counter, unsigned long Value = 1) {
+    Counters[Counter].fetch_add(Value, std::memory_order_relaxed);
+    ThreadCounters.Values[Counter] += Value;
+  }
+
+  /// Keep the maximum of the values given for the counter
+  static void countMax(RunCounter Counter, unsigned long Value);
+
+  static unsigned long getCounter(RunCounter Counter) {
+    return Counters[Counter];
+  }
+
+  /// Start counting a unit of work of the calling thread, return the state
+  /// to give to endThreadWork
+  static CounterSet beginThreadWork();
+
+  /// Return the work counted by the calling thread since beginThreadWork,
+  /// the maximum counters are those of the unit of work
+  static CounterSet endThreadWork(const CounterSet &Start);
+
+  /// Add the work of another thread (a helper of -j) to the calling thread
+  static void addThreadWork(const CounterSet &Work);
+
+  /// Record the work done for a synthesized function
+  static void addCandidate(const CandidateStatistics &Candidate);
+
+  /// Print the phases, the counters and the most expensive candidates
+  static void print(llvm::raw_ostream &OS);
+
+  /// Write the report as JSON, return false if the file cannot be written
+  static bool writeJSON(const std::string &FileName);
+};
+
+/// Add the time of its scope to a phase, and to the candidate if given. Nested
+/// timers of the same thread pause the enclosing one so that each phase only
+/// gets its own time
+class PhaseTimer {
+private:
+  RunPhase Phase;
+  CandidateStatistics *Candidate;
+  std::chrono::steady_clock::time_point Start;
+  std::chrono::nanoseconds Elapsed;
+
+  /// The enclosing timer of the thread
+  PhaseTimer *Parent;
+
+  static thread_local PhaseTimer *Active;
+
+public:
+  PhaseTimer(RunPhase Phase, CandidateStatistics *Candidate = nullptr);
+
+  ~PhaseTimer();
+};
+
+#endif
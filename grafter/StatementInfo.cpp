@@ -12,6 +12,24 @@
 
 #define DEBUG_TYPE "stmt-info"
 
+extern llvm::cl::OptionCategory TreeFuserCategory;
+
+namespace opts {
+llvm::cl::opt<bool> NormalizeAutomata(
+    "normalize-automata",
+    cl::desc("remove epsilons, determinize and minimize the automata of the "
+             "statements before the dependence analysis"),
+    cl::init(true), cl::Optional, cl::cat(TreeFuserCategory));
+} // namespace opts
+
+/// Prepare a built automata for the dependence queries
+static void finalizeAutomata(FSM *Automata) {
+  if (opts::NormalizeAutomata)
+    FSMUtility::normalize(*Automata);
+  else
+    fst::ArcSort(Automata, fst::ILabelCompare<fst::StdArc>());
+}
+
 const CXXRecordDecl *StatementInfo::getTraversedTypeDecl() {
   assert(IsCallStmt);
   if (CalledChild == nullptr)
@@ -23,19 +41,19 @@ const CXXRecordDecl *StatementInfo::getTraversedTypeDecl() {
 
 const FSM &StatementInfo::getLocalWritesAutomata() {
   if (!LocalWritesAutomata) {
-    LocalWritesAutomata = new FSM();
+    LocalWritesAutomata = FSMUtility::createFSM();
     for (auto *AccessPath : getAccessPaths().getWriteSet()) {
       if (AccessPath->isLocal())
         fst::Union(LocalWritesAutomata, AccessPath->getWriteAutomata());
     }
-    fst::ArcSort(LocalWritesAutomata, fst::ILabelCompare<fst::StdArc>());
+    finalizeAutomata(LocalWritesAutomata);
   }
   return *LocalWritesAutomata;
 }
 
 const FSM &StatementInfo::getLocalReadsAutomata() {
   if (!LocalReadsAutomata) {
-    LocalReadsAutomata = new FSM();
+    LocalReadsAutomata = FSMUtility::createFSM();
 
     for (auto *AccessPath : getAccessPaths().getReadSet()) {
       if (AccessPath->isLocal())
@@ -46,19 +64,19 @@ const FSM &StatementInfo::getLocalReadsAutomata() {
       if (AccessPath->isLocal())
         fst::Union(LocalReadsAutomata, AccessPath->getReadAutomata());
     }
-    fst::ArcSort(LocalReadsAutomata, fst::ILabelCompare<fst::StdArc>());
+    finalizeAutomata(LocalReadsAutomata);
   }
   return *LocalReadsAutomata;
 }
 
 const FSM &StatementInfo::getGlobWritesAutomata(bool IncludeExtended) {
   if (!BaseGlobalWritesAutomata) {
-    BaseGlobalWritesAutomata = new FSM();
+    BaseGlobalWritesAutomata = FSMUtility::createFSM();
     for (auto *AccessPath : getAccessPaths().getWriteSet()) {
       if (AccessPath->isGlobal())
         fst::Union(BaseGlobalWritesAutomata, AccessPath->getWriteAutomata());
     }
-    fst::ArcSort(BaseGlobalWritesAutomata, fst::ILabelCompare<fst::StdArc>());
+    finalizeAutomata(BaseGlobalWritesAutomata);
   }
   if (isCallStmt() && IncludeExtended)
     return getExtendedGlobWritesAutomata(); // the extended include the basic
@@ -68,7 +86,7 @@ const FSM &StatementInfo::getGlobWritesAutomata(bool IncludeExtended) {
 
 const FSM &StatementInfo::getGlobReadsAutomata(bool IncludeExtended) {
   if (!BaseGlobalReadsAutomata) {
-    BaseGlobalReadsAutomata = new FSM();
+    BaseGlobalReadsAutomata = FSMUtility::createFSM();
 
     for (auto *AccessPath : getAccessPaths().getReadSet()) {
       if (AccessPath->isGlobal())
@@ -79,7 +97,7 @@ const FSM &StatementInfo::getGlobReadsAutomata(bool IncludeExtended) {
       if (AccessPath->isGlobal())
         fst::Union(BaseGlobalReadsAutomata, AccessPath->getReadAutomata());
     }
-    fst::ArcSort(BaseGlobalReadsAutomata, fst::ILabelCompare<fst::StdArc>());
+    finalizeAutomata(BaseGlobalReadsAutomata);
   }
   if (isCallStmt() && IncludeExtended)
     return getExtendedGlobReadsAutomata(); // the extended include the basic
@@ -89,7 +107,7 @@ const FSM &StatementInfo::getGlobReadsAutomata(bool IncludeExtended) {
 
 const FSM &StatementInfo::getTreeReadsAutomata(bool IncludeExtended) {
   if (!BaseTreeReadsAutomata) {
-    BaseTreeReadsAutomata = new FSM();
+    BaseTreeReadsAutomata = FSMUtility::createFSM();
 
     for (auto *AccessPath : getAccessPaths().getReadSet()) {
       if (AccessPath->isOnTree())
@@ -105,7 +123,7 @@ const FSM &StatementInfo::getTreeReadsAutomata(bool IncludeExtended) {
       assert(AccessPath->isOnTree());
       fst::Union(BaseTreeReadsAutomata, AccessPath->getReadAutomata());
     }
-    fst::ArcSort(BaseTreeReadsAutomata, fst::ILabelCompare<fst::StdArc>());
+    finalizeAutomata(BaseTreeReadsAutomata);
   }
   if (isCallStmt() && IncludeExtended)
     return getExtendedTreeReadsAutomata();
@@ -115,7 +133,7 @@ const FSM &StatementInfo::getTreeReadsAutomata(bool IncludeExtended) {
 
 const FSM &StatementInfo::getTreeWritesAutomata(bool IncludeExtended) {
   if (!BaseTreeWritesAutomata) {
-    BaseTreeWritesAutomata = new FSM();
+    BaseTreeWritesAutomata = FSMUtility::createFSM();
 
     for (auto *AccessPath : getAccessPaths().getWriteSet()) {
       if (AccessPath->isOnTree())
@@ -127,7 +145,7 @@ const FSM &StatementInfo::getTreeWritesAutomata(bool IncludeExtended) {
       assert(AccessPath->isOnTree());
       fst::Union(BaseTreeWritesAutomata, AccessPath->getWriteAutomata());
     }
-    fst::ArcSort(BaseTreeWritesAutomata, fst::ILabelCompare<fst::StdArc>());
+    finalizeAutomata(BaseTreeWritesAutomata);
   }
   if (isCallStmt() && IncludeExtended)
     return getExtendedTreeWritesAutomata();
@@ -225,7 +243,8 @@ void buildFromCall(
     PossiblyCalledFunctions.insert(CalledFunctionInfo);
 
     // For each possible derived type add the corresponding called method
-    for (auto *DerivedRecord : RecordsAnalyzer::DerivedRecords[ChildRecord]) {
+    for (auto *DerivedRecord :
+         RecordsAnalyzer::getDerivedRecords(ChildRecord)) {
       auto *CalledMethod =
           dyn_cast<CXXMethodDecl>(CallStmt->getCalledFunction())
               ->getCorrespondingMethodInClass(DerivedRecord)
@@ -276,7 +295,7 @@ void buildFromCall(
 const FSM &StatementInfo::getExtendedTreeReadsAutomata() {
   assert(isCallStmt());
   if (!ExtendedTreeReadsAutomata) {
-    ExtendedTreeReadsAutomata = new FSM();
+    ExtendedTreeReadsAutomata = FSMUtility::createFSM();
     ExtendedTreeReadsAutomata->AddState();
     ExtendedTreeReadsAutomata->SetStart(0);
     ExtendedTreeReadsAutomata->AddState();
@@ -286,7 +305,7 @@ const FSM &StatementInfo::getExtendedTreeReadsAutomata() {
     std::unordered_map<FunctionAnalyzer *, int> EmptyTable;
     buildFromCall(ExtendedTreeReadsAutomata, 1, this, EmptyTable, true);
 
-    fst::ArcSort(ExtendedTreeReadsAutomata, fst::ILabelCompare<fst::StdArc>());
+    finalizeAutomata(ExtendedTreeReadsAutomata);
   }
   return *ExtendedTreeReadsAutomata;
 }
@@ -294,7 +313,7 @@ const FSM &StatementInfo::getExtendedTreeReadsAutomata() {
 const FSM &StatementInfo::getExtendedTreeWritesAutomata() {
   assert(isCallStmt());
   if (!ExtendedTreeWritesAutomata) {
-    ExtendedTreeWritesAutomata = new FSM();
+    ExtendedTreeWritesAutomata = FSMUtility::createFSM();
     ExtendedTreeWritesAutomata->AddState();
     ExtendedTreeWritesAutomata->SetStart(0);
     ExtendedTreeWritesAutomata->AddState();
@@ -304,7 +323,7 @@ const FSM &StatementInfo::getExtendedTreeWritesAutomata() {
 
     buildFromCall(ExtendedTreeWritesAutomata, 1, this, EmtyTable, false);
 
-    fst::ArcSort(ExtendedTreeWritesAutomata, fst::ILabelCompare<fst::StdArc>());
+    finalizeAutomata(ExtendedTreeWritesAutomata);
   }
 
   return *ExtendedTreeWritesAutomata;
@@ -313,7 +332,7 @@ const FSM &StatementInfo::getExtendedTreeWritesAutomata() {
 const FSM &StatementInfo::getExtendedGlobReadsAutomata() {
   assert(isCallStmt());
   if (!ExtendedGlobalReadsAutomata) {
-    ExtendedGlobalReadsAutomata = new FSM();
+    ExtendedGlobalReadsAutomata = FSMUtility::createFSM();
 
     auto *ChildRecord = getTraversedTypeDecl();
 
@@ -328,7 +347,8 @@ const FSM &StatementInfo::getExtendedGlobReadsAutomata() {
       PossiblyCalledFunctions.insert(CalledFunctionInfo);
 
       // For each possible derived type add the corresponding called method
-      for (auto *DerivedRecord : RecordsAnalyzer::DerivedRecords[ChildRecord]) {
+      for (auto *DerivedRecord :
+           RecordsAnalyzer::getDerivedRecords(ChildRecord)) {
         auto *CalledMethod = dyn_cast<CXXMethodDecl>(getCalledFunction())
                                  ->getCorrespondingMethodInClass(DerivedRecord)
                                  ->getDefinition();
@@ -350,8 +370,7 @@ const FSM &StatementInfo::getExtendedGlobReadsAutomata() {
                    Stmt->getGlobReadsAutomata(false));
     }
 
-    fst::ArcSort(ExtendedGlobalReadsAutomata,
-                 fst::ILabelCompare<fst::StdArc>());
+    finalizeAutomata(ExtendedGlobalReadsAutomata);
   }
   return *ExtendedGlobalReadsAutomata;
 }
@@ -359,7 +378,7 @@ const FSM &StatementInfo::getExtendedGlobReadsAutomata() {
 const FSM &StatementInfo::getExtendedGlobWritesAutomata() {
   assert(isCallStmt());
   if (!ExtendedGlobalWritesAutomata) {
-    ExtendedGlobalWritesAutomata = new FSM();
+    ExtendedGlobalWritesAutomata = FSMUtility::createFSM();
 
     auto *ChildRecord = getTraversedTypeDecl();
 
@@ -374,7 +393,8 @@ const FSM &StatementInfo::getExtendedGlobWritesAutomata() {
       PossiblyCalledFunctions.insert(CalledFunctionInfo);
 
       // For each possible derived type add the corresponding called method
-      for (auto *DerivedRecord : RecordsAnalyzer::DerivedRecords[ChildRecord]) {
+      for (auto *DerivedRecord :
+           RecordsAnalyzer::getDerivedRecords(ChildRecord)) {
         auto *CalledMethod = dyn_cast<CXXMethodDecl>(getCalledFunction())
                                  ->getCorrespondingMethodInClass(DerivedRecord)
                                  ->getDefinition();
@@ -397,8 +417,43 @@ const FSM &StatementInfo::getExtendedGlobWritesAutomata() {
       }
     }
 
-    fst::ArcSort(ExtendedGlobalWritesAutomata,
-                 fst::ILabelCompare<fst::StdArc>());
+    finalizeAutomata(ExtendedGlobalWritesAutomata);
   }
   return *ExtendedGlobalWritesAutomata;
 }
+
+const FSM &StatementInfo::getAccessSetAutomata(ACCESS_SET Set) {
+  switch (Set) {
+  case LOCAL_WRITES:
+    return getLocalWritesAutomata();
+  case LOCAL_READS:
+    return getLocalReadsAutomata();
+  case GLOBAL_WRITES:
+    return getGlobWritesAutomata();
+  case GLOBAL_READS:
+    return getGlobReadsAutomata();
+  case TREE_WRITES:
+    return getTreeWritesAutomata();
+  case TREE_READS:
+    return getTreeReadsAutomata();
+  default:
+    llvm_unreachable("unknown access set");
+  }
+}
+
+const AccessPathTrie *StatementInfo::getAccessSetTrie(ACCESS_SET Set) {
+  if (!AccessSetTriesBuilt[Set]) {
+    AccessSetTries[Set] = AccessPathTrie::build(getAccessSetAutomata(Set));
+    AccessSetTriesBuilt[Set] = true;
+  }
+  return AccessSetTries[Set];
+}
+
+size_t StatementInfo::getAccessSetHash(ACCESS_SET Set) {
+  if (!AccessSetHashesBuilt[Set]) {
+    AccessSetHashes[Set] =
+        FSMUtility::getStructuralHash(getAccessSetAutomata(Set));
+    AccessSetHashesBuilt[Set] = true;
+  }
+  return AccessSetHashes[Set];
+}
@@ -12,11 +12,27 @@
 #ifndef TREE_FUSER_STATMENT_INFO
 #define TREE_FUSER_STATMENT_INFO
 
+#include "AccessPathTrie.h"
 #include "FunctionAnalyzer.h"
+#include "MemoryArena.h"
 #include <stack>
 #include <stdio.h>
 
-class StatementInfo {
+/// The access sets of a statement that are checked for conflicts by the
+/// dependence analysis
+enum ACCESS_SET {
+  LOCAL_WRITES,
+  LOCAL_READS,
+  GLOBAL_WRITES,
+  GLOBAL_READS,
+  TREE_WRITES,
+  TREE_READS,
+  ACCESS_SETS_COUNT
+};
+
+/// Statement information lives as long as the run, neither the object nor its
+/// automata and tries are released before the end of the run
+class StatementInfo : public ArenaAllocated {
 private:
   /// A unique id for the statment within the traversal body
   int StatementId;
@@ -73,6 +89,20 @@ private:
   /// invocations of call statement
   FSM *ExtendedGlobalWritesAutomata = nullptr;
 
+  /// Tries of the access sets used by the trie dependence engine, null if
+  /// the language of the set is not linear
+  AccessPathTrie *AccessSetTries[ACCESS_SETS_COUNT] = {};
+
+  /// Whether the trie of each access set is already built
+  bool AccessSetTriesBuilt[ACCESS_SETS_COUNT] = {};
+
+  /// Structural hashes of the automata of the access sets, they identify
+  /// the automata in the query caches of FSMUtility
+  size_t AccessSetHashes[ACCESS_SETS_COUNT] = {};
+
+  /// Whether the hash of each access set is already computed
+  bool AccessSetHashesBuilt[ACCESS_SETS_COUNT] = {};
+
   const FSM &getExtendedTreeReadsAutomata();
 
   const FSM &getExtendedTreeWritesAutomata();
@@ -140,6 +170,16 @@ public:
   const FSM &getTreeReadsAutomata(bool IncludeExtended = true);
 
   const FSM &getTreeWritesAutomata(bool IncludeExtended = true);
+
+  /// Return the automata of an access set (including the extended accesses)
+  const FSM &getAccessSetAutomata(ACCESS_SET Set);
+
+  /// Return the trie of an access set, or null if its language is not linear
+  const AccessPathTrie *getAccessSetTrie(ACCESS_SET Set);
+
+  /// Return the structural hash of the automata of an access set, it is
+  /// computed once with the automata
+  size_t getAccessSetHash(ACCESS_SET Set);
 };
 
 #endif
@@ -9,14 +9,22 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "AccessPathTrie.h"
+#include "FSMUtility.h"
+#include "FusionCache.h"
 #include "FunctionAnalyzer.h"
 #include "FunctionsFinder.h"
 #include "FuseTransformation.h"
 #include "LLVMDependencies.h"
 #include "Logger.h"
+#include "MemoryArena.h"
 #include "RecordAnalyzer.h"
+#include "RunStatistics.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/ThreadPool.h"
 
 #include <assert.h>
+#include <functional>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -27,44 +35,118 @@ llvm::cl::OptionCategory TreeFuserCategory("TreeFuser options:");
 static cl::extrahelp CommonHelp(CommonOptionsParser::HelpMessage);
 static cl::extrahelp MoreHelp("");
 
+namespace opts {
+llvm::cl::opt<bool>
+    PrintFSMStats("print-fsm-stats",
+                  cl::desc("print statistics of the automata query cache"),
+                  cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> ParallelTranslationUnits(
+    "parallel-tu",
+    cl::desc("analyze and transform the translation units concurrently using "
+             "-j threads"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> PrintMemoryStats(
+    "print-memory-stats",
+    cl::desc("print the memory used by the analysis and the number of "
+             "allocated graphs, nodes and automata"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool>
+    TimeReport("time-report",
+               cl::desc("print the time spent in each phase and the work "
+                        "done by the analysis"),
+               cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<std::string> TimeReportJSON(
+    "time-report-json",
+    cl::desc("write the time spent in each phase and the work done for each "
+             "synthesized function to the given JSON file"),
+    cl::init(""), cl::Optional, cl::cat(TreeFuserCategory));
+
+extern llvm::cl::opt<unsigned> Threads;
+} // namespace opts
+
+/// Run an action on each translation unit, concurrently with -parallel-tu
+static void
+forEachUnit(std::vector<std::unique_ptr<ASTUnit>> &ASTList,
+            const std::function<void(clang::ASTContext &Ctx)> &Action) {
+  if (!opts::ParallelTranslationUnits || opts::Threads <= 1) {
+    for (auto &ASTUnit : ASTList)
+      Action(ASTUnit.get()->getASTContext());
+    return;
+  }
+
+  llvm::ThreadPool Pool(opts::Threads);
+  for (auto &ASTUnit : ASTList) {
+    auto *Ctx = &ASTUnit.get()->getASTContext();
+    Pool.async([&Action, Ctx]() { Action(*Ctx); });
+  }
+  Pool.wait();
+}
+
 int main(int argc, const char **argv) {
   clang::tooling::CommonOptionsParser OptionsParser(argc, argv,
                                                     TreeFuserCategory);
   clang::tooling::ClangTool ClangTool(OptionsParser.getCompilations(),
                                       OptionsParser.getSourcePathList());
+  FusionCache::setCommandLine(argc, argv);
 
+  // Each input is parsed once, compilation errors are reported by the
+  // diagnostics of the built units
   std::vector<std::unique_ptr<ASTUnit>> ASTList;
-  ClangTool.buildASTs(ASTList);
+  bool HasCompilationError = ClangTool.buildASTs(ASTList) != 0;
 
-  if (ClangTool.run(
-          newFrontendActionFactory<clang::SyntaxOnlyAction>().get())) {
+  for (auto &ASTUnit : ASTList)
+    HasCompilationError |= ASTUnit->getDiagnostics().hasErrorOccurred();
+
+  if (HasCompilationError) {
     errs() << "ERROR: input source files have a compilation error";
     return 0;
   }
 
-  RecordsAnalyzer RecordAnalyserInstance;
   FunctionsFinder FunctionsInfo;
 
+  // The records tables are created upfront so that the contexts can be
+  // analyzed concurrently
+  for (auto &ASTUnit : ASTList)
+    RecordsAnalyzer::registerContext(&ASTUnit.get()->getASTContext());
+
   outs() << ("INFO: anlyzing records\n");
 
-  for (auto &ASTUnit : ASTList)
-    RecordAnalyserInstance.analyzeRecordsDeclarations(
-        ASTUnit.get()->getASTContext());
+  forEachUnit(ASTList, [](clang::ASTContext &Ctx) {
+    PhaseTimer Timer(RP_Records);
+    RecordsAnalyzer RecordAnalyserInstance;
+    RecordAnalyserInstance.analyzeRecordsDeclarations(Ctx);
+  });
 
   outs() << ("INFO: analyzing functions\n");
 
-  for (auto &ASTUnit : ASTList)
-    FunctionsInfo.findFunctions(ASTUnit.get()->getASTContext());
+  forEachUnit(ASTList, [](clang::ASTContext &Ctx) {
+    PhaseTimer Timer(RP_Functions);
+    FunctionsFinder ContextFunctionsFinder;
+    ContextFunctionsFinder.findFunctions(Ctx);
+  });
+  {
+    PhaseTimer Timer(RP_Functions);
+    FunctionsInfo.validateFunctions();
+  }
 
   outs() << ("INFO: running transformation\n");
 
-  for (auto &ASTUnit : ASTList) {
-    auto *Ctx = &ASTUnit.get()->getASTContext();
-    FusionCandidatesFinder CandidatesFinder(Ctx, &FunctionsInfo);
+  // Translation units may share headers, files are written one at a time
+  llvm::sys::SmartMutex<true> OverwriteLock;
+
+  forEachUnit(ASTList, [&](clang::ASTContext &Ctx) {
+    FusionCandidatesFinder CandidatesFinder(&Ctx, &FunctionsInfo);
 
     // Find candidates
-    CandidatesFinder.findCandidates();
-    FusionTransformer Transformer(Ctx, &FunctionsInfo);
+    {
+      PhaseTimer Timer(RP_Candidates);
+      CandidatesFinder.findCandidates();
+    }
+    FusionTransformer Transformer(&Ctx, &FunctionsInfo);
 
     // Perform fusion
     for (auto &Entry : CandidatesFinder.getFusionCandidates()) {
@@ -75,7 +157,23 @@ int main(int argc, const char **argv) {
         // Commit source file changes
       }
     }
+    llvm::sys::SmartScopedLock<true> Guard(OverwriteLock);
+    PhaseTimer Timer(RP_Rewriting);
     Transformer.overwriteChangedFiles();
+  });
+
+  if (opts::PrintFSMStats) {
+    FSMUtility::printQueryCacheStatistics(outs());
+    FSMUtility::printNormalizationStatistics(outs());
+    AccessPathTrie::printStatistics(outs());
   }
+  if (FusionCache::isEnabled())
+    FusionCache::printStatistics(outs());
+  if (opts::PrintMemoryStats)
+    MemoryStatistics::print(outs());
+  if (opts::TimeReport)
+    RunStatistics::print(outs());
+  if (!opts::TimeReportJSON.empty())
+    RunStatistics::writeJSON(opts::TimeReportJSON);
   return 0;
 }
@@ -11,19 +11,125 @@
 //===----------------------------------------------------------------------===//
 
 #include "TraversalSynthesizer.h"
+#include "FusionProfile.h"
+#include "RunStatistics.h"
+#include "llvm/Support/Mutex.h"
+#include <algorithm>
 
 #define FUSE_CAP 2
 #define diff_CAP 4
 using namespace std;
 
+extern llvm::cl::OptionCategory TreeFuserCategory;
+
+namespace opts {
+llvm::cl::opt<bool> FusionInstrument(
+    "fusion-instrument",
+    cl::desc("make the synthesized traversals record a profile of the truncate "
+             "flags at their entry and call sites (see -fusion-profile)"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> SpecializeFlags(
+    "specialize-flags",
+    cl::desc("emit a clone of each synthesized traversal specialized for the "
+             "case where all the traversals are active"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> UnfusedFallback(
+    "unfused-fallback",
+    cl::desc("call the original traversal when only one of the traversals of "
+             "a fused call is active"),
+    cl::init(true), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> DedupFused(
+    "dedup-fused",
+    cl::desc("fuse independent calls in a canonical order and emit identical "
+             "synthesized traversals once"),
+    cl::init(true), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> Parallel(
+    "parallel",
+    cl::desc("run the independent calls of the synthesized traversals as "
+             "OpenMP tasks (the output must be compiled with -fopenmp)"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<unsigned> ParallelDepth(
+    "parallel-depth",
+    cl::desc("with -parallel, the calls deeper than this number of fused "
+             "calls run sequentially"),
+    cl::init(8), cl::Optional, cl::cat(TreeFuserCategory));
+
+enum ParallelRuntimeKind { PR_OpenMP, PR_Grafter };
+
+llvm::cl::opt<ParallelRuntimeKind> ParallelRuntime(
+    "parallel-runtime",
+    cl::desc("the runtime that runs the tasks of -parallel"),
+    cl::values(clEnumValN(PR_OpenMP, "openmp",
+                          "OpenMP tasks (compile the output with -fopenmp)"),
+               clEnumValN(PR_Grafter, "grafter",
+                          "the work-stealing runtime of "
+                          "runtime/grafter_runtime.h")),
+    cl::init(PR_OpenMP), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> TailLoops(
+    "tail-loops",
+    cl::desc("turn a call of a synthesized traversal to itself that ends its "
+             "body into a jump to its beginning"),
+    cl::init(true), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> Devirtualize(
+    "devirtualize",
+    cl::desc("dispatch the fused virtual calls with a switch on a type tag "
+             "instead of a virtual stub"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<std::string> DevirtualizeTagField(
+    "devirtualize-tag-field",
+    cl::desc("with -devirtualize, an existing field of the traversed classes "
+             "that holds their type tag (see -devirtualize-tag), by default "
+             "a tag field is added to the classes"),
+    cl::init(""), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::list<std::string> DevirtualizeTags(
+    "devirtualize-tag",
+    cl::desc("<class>=<value>, the value of -devirtualize-tag-field for the "
+             "objects of the class, the other classes use the virtual stub"),
+    cl::CommaSeparated, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> Iterative(
+    "iterative",
+    cl::desc("run the calls of a synthesized traversal to itself on an "
+             "explicit stack of frames instead of the call stack (ignored "
+             "with -parallel)"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<unsigned> IterativeStackReserve(
+    "iterative-stack-reserve",
+    cl::desc("with -iterative, the number of frames the stacks reserve at "
+             "their first call"),
+    cl::init(64), cl::Optional, cl::cat(TreeFuserCategory));
+} // namespace opts
+
 std::map<clang::FunctionDecl *, int> TraversalSynthesizer::FunDeclToNameId =
     std::map<clang::FunctionDecl *, int>();
-std::map<std::vector<clang::CallExpr *>, string> TraversalSynthesizer::Stubs =
-    std::map<std::vector<clang::CallExpr *>, string>();
-std::unordered_map<const CXXRecordDecl *, std::set<std::string>> InsertedStubs =
-    std::unordered_map<const CXXRecordDecl *, std::set<std::string>>();
 int TraversalSynthesizer::Count = 1;
 
+/// Guards the function ids, names must be unique across the contexts
+static llvm::sys::SmartMutex<true> FunctionIdsLock;
+
+/// The label at the beginning of the synthesized functions that loop on
+/// their last call (-tail-loops)
+static const std::string TailLabel = "_grafter_tail";
+
+/// The label where -iterative functions enter the frame on top of the stack
+static const std::string EnterLabel = "_grafter_enter";
+
+/// The prefix of the labels where -iterative functions resume after a call
+static const std::string ResumeLabel = "_grafter_resume";
+
+/// The name of the tag field added to the traversed classes
+static const std::string TagFieldName = "__grafter_tag";
+
 std::string toBinaryString(unsigned Input) {
   string Output;
   while (Input != 0) {
@@ -101,6 +207,7 @@ std::string TraversalSynthesizer::createName(
 
   std::string Output = string("_fuse_") + "_";
 
+  llvm::sys::SmartScopedLock<true> Guard(FunctionIdsLock);
   for (auto *FuncDecl : ParticipatingTraversals) {
     FuncDecl = FuncDecl->getDefinition();
     if (!FunDeclToNameId.count(FuncDecl)) {
@@ -116,6 +223,7 @@ std::string TraversalSynthesizer::createName(
 }
 
 int TraversalSynthesizer::getFunctionId(clang::FunctionDecl *Decl) {
+  llvm::sys::SmartScopedLock<true> Guard(FunctionIdsLock);
   assert(FunDeclToNameId.count(Decl));
 
   return FunDeclToNameId[Decl];
@@ -136,7 +244,8 @@ string &Decls,*/ std::string &BlockPart,
                         &ParticipatingTraversalsDecl,
                     const int BlockId,
                     std::unordered_map<int, vector<DG_Node *>> &Statements,
-                    bool HasCXXCall) {
+                    bool HasCXXCall,
+                    std::vector<std::pair<std::string, std::string>> *Locals) {
   StatementPrinter Printer;
 
   for (int TraversalIndex = 0;
@@ -168,11 +277,14 @@ string &Decls,*/ std::string &BlockPart,
           auto *VarDecl = dyn_cast<clang::VarDecl>(D);
 
           // add the  declaration at the top of the block body
-          Declarations +=
-              StringReplace(VarDecl->getType().getAsString(), "const", "") +
-              " ";
-          Declarations += "_f" + to_string(TraversalIndex) + "_" +
-                          VarDecl->getNameAsString() + ";\n";
+          string Type =
+              StringReplace(VarDecl->getType().getAsString(), "const", "");
+          string Name = "_f" + to_string(TraversalIndex) + "_" +
+                        VarDecl->getNameAsString();
+          if (Locals)
+            Locals->push_back(std::make_pair(Type, Name));
+          else
+            Declarations += Type + " " + Name + ";\n";
 
           if (VarDecl->hasInit()) {
             BlockBody +=
@@ -190,7 +302,7 @@ string &Decls,*/ std::string &BlockPart,
 
       } else {
         // Nullptr is passed as root decl TODO:
-        BlockBody += Printer.printStmt(
+        BlockBody += Printer.printBodyStmt(
             Statement->getStatementInfo()->Stmt, ASTCtx->getSourceManager(),
             FunctionsFinder::getFunctionInfo(Decl)->isGlobal()
                 ? Decl->getParamDecl(0)
@@ -216,7 +328,7 @@ void TraversalSynthesizer::setCallPart(
     const std::vector<clang::CallExpr *> &ParticipatingCallExpr,
     const std::vector<clang::FunctionDecl *> &ParticipatingTraversalsDecl,
     DG_Node *CallNode, FusedTraversalWritebackInfo *WriteBackInfo,
-    bool HasCXXCall) {
+    bool HasCXXCall, std::string *TailCallText) {
   CallPartText = "";
   StatementPrinter Printer;
 
@@ -229,6 +341,9 @@ void TraversalSynthesizer::setCallPart(
   if (!NextCallNodes.size())
     return;
 
+  if (opts::DedupFused)
+    canonicalizeCallOrder(NextCallNodes);
+
   // The call should be executed iff one of at least of the participating nodes
   // is active
   unsigned int ConditionBitMask = 0;
@@ -237,6 +352,19 @@ void TraversalSynthesizer::setCallPart(
     ConditionBitMask |=
         (1 << Node->getTraversalId() /*should return the index*/);
 
+  if (opts::FusionInstrument) {
+    std::vector<std::string> NodeIds;
+    std::string SiteName = "_grafter_site";
+    for (DG_Node *Node : NextCallNodes) {
+      NodeIds.push_back(FusionProfile::getNodeId(Node));
+      SiteName += "_t" + to_string(Node->getTraversalId()) + "s" +
+                  to_string(Node->getStatementInfo()->getStatementId());
+    }
+    CallPartText += FusionProfile::getSiteText(WriteBackInfo->ProfileKey,
+                                               SiteName, NodeIds,
+                                               WriteBackInfo->TraversalsCount);
+  }
+
   string CallConditionText = "if ( (truncate_flags & " +
                              toBinaryString(ConditionBitMask) + ") )/*call*/";
   CallPartText += CallConditionText + "{\n\t";
@@ -264,7 +392,7 @@ void TraversalSynthesizer::setCallPart(
                   ->getParamDecl(0)
             : nullptr;
 
-    CallPartText += Printer.printStmt(
+    CallPartText += Printer.printBodyStmt(
         NextCallNodes[0]->getStatementInfo()->Stmt, ASTCtx->getSourceManager(),
         RootDecl, "not used", CallNode->getTraversalId(),
         /*replace this*/ HasCXXCall, HasCXXCall);
@@ -276,6 +404,31 @@ void TraversalSynthesizer::setCallPart(
   // dd adjusted flags code
   CallPartText += AdjustedFlagCode;
 
+  // When a single traversal is still active call its original (unfused)
+  // traversal, bit i of the adjusted flags corresponds to NextCallNodes[i]
+  if (opts::UnfusedFallback) {
+    for (int i = 0; i < NextCallNodes.size(); i++) {
+      auto *Node = NextCallNodes[i];
+      auto *NodeRootDecl =
+          Node->getStatementInfo()->getEnclosingFunction()->isGlobal()
+              ? Node->getStatementInfo()
+                    ->getEnclosingFunction()
+                    ->getFunctionDecl()
+                    ->getParamDecl(0)
+              : nullptr;
+
+      CallPartText += string(i == 0 ? "" : "else ") +
+                      "if (AdjustedTruncateFlags == " +
+                      toBinaryString(1 << i) + ") {\n";
+      CallPartText += Printer.printBodyStmt(
+          Node->getStatementInfo()->Stmt, ASTCtx->getSourceManager(),
+          NodeRootDecl, "not used", Node->getTraversalId(),
+          /*replace this*/ HasCXXCall, HasCXXCall);
+      CallPartText += "\n}\n";
+    }
+    CallPartText += "else {\n";
+  }
+
   std::vector<clang::CallExpr *> NexTCallExpressions;
 
   for (auto *Node : NextCallNodes)
@@ -295,7 +448,7 @@ void TraversalSynthesizer::setCallPart(
   }
 
   std::string NextCallName;
-  string NextCallParamsText;
+  std::vector<string> NextCallArgs;
 
   if (!HasVirtual)
     NextCallName = createName(NexTCallExpressions, false, nullptr);
@@ -309,6 +462,10 @@ void TraversalSynthesizer::setCallPart(
       NexTCallExpressions, /*IsTopLevel*/ false,
       CallNode->getStatementInfo()->getEnclosingFunction()->getFunctionDecl());
 
+  // the called function may turn out identical to one synthesized before
+  if (!HasVirtual)
+    NextCallName = resolveAlias(NextCallName);
+
   auto *RootDeclCallNode =
       CallNode->getStatementInfo()->getEnclosingFunction()->isGlobal()
           ? CallNode->getStatementInfo()
@@ -318,6 +475,7 @@ void TraversalSynthesizer::setCallPart(
           : nullptr;
 
   // Create the call
+  size_t CallStart = CallPartText.size();
   if (!HasVirtual) {
 
     CallPartText += NextCallName + "(";
@@ -327,24 +485,36 @@ void TraversalSynthesizer::setCallPart(
       auto FirstArgument =
           dyn_cast<clang::CallExpr>(CallNode->getStatementInfo()->Stmt)
               ->getArg(0);
-      NextCallParamsText += Printer.printStmt(
+      NextCallArgs.push_back(Printer.printStmt(
           FirstArgument, ASTCtx->getSourceManager(), RootDeclCallNode, "",
-          CallNode->getTraversalId(), HasCXXCall, HasCXXCall);
+          CallNode->getTraversalId(), HasCXXCall, HasCXXCall));
 
     } else if (CallNode->getStatementInfo()->Stmt->getStmtClass() ==
                clang::Stmt::CXXMemberCallExprClass) {
-      NextCallParamsText +=
-          Printer.printStmt(CallNode->getStatementInfo()
-                                ->Stmt->child_begin()
-                                ->child_begin()
-                                ->IgnoreImplicit(),
-                            ASTCtx->getSourceManager(), RootDeclCallNode, "",
-                            CallNode->getTraversalId(), HasCXXCall, HasCXXCall);
+      NextCallArgs.push_back(Printer.printStmt(
+          CallNode->getStatementInfo()
+              ->Stmt->child_begin()
+              ->child_begin()
+              ->IgnoreImplicit(),
+          ASTCtx->getSourceManager(), RootDeclCallNode, "",
+          CallNode->getTraversalId(), HasCXXCall, HasCXXCall));
     }
 
   } else {
     if (CallNode->getStatementInfo()->Stmt->getStmtClass() ==
-        clang::Stmt::CXXMemberCallExprClass) {
+            clang::Stmt::CXXMemberCallExprClass &&
+        opts::Devirtualize) {
+      // the dispatch function takes the receiver as first argument
+      CallPartText += NextCallName + "_dispatch(";
+      NextCallArgs.push_back(Printer.printStmt(
+          CallNode->getStatementInfo()
+              ->Stmt->child_begin()
+              ->child_begin()
+              ->IgnoreImplicit(),
+          ASTCtx->getSourceManager(), RootDeclCallNode, "",
+          CallNode->getTraversalId(), HasCXXCall, HasCXXCall));
+    } else if (CallNode->getStatementInfo()->Stmt->getStmtClass() ==
+               clang::Stmt::CXXMemberCallExprClass) {
       CallPartText += Printer.printStmt(
                           CallNode->getStatementInfo()
                               ->Stmt->child_begin()
@@ -360,9 +530,9 @@ void TraversalSynthesizer::setCallPart(
               ->getArg(0);
 
       CallPartText += NextCallName + "(";
-      NextCallParamsText += Printer.printStmt(
+      NextCallArgs.push_back(Printer.printStmt(
           FirstArgument, ASTCtx->getSourceManager(), RootDeclCallNode, "",
-          CallNode->getTraversalId(), HasCXXCall, HasCXXCall);
+          CallNode->getTraversalId(), HasCXXCall, HasCXXCall));
     } else {
       llvm_unreachable("unexpected");
     }
@@ -383,21 +553,85 @@ void TraversalSynthesizer::setCallPart(
                  ? 1
                  : 0;
          ArgIdx < CallExpr->getNumArgs(); ArgIdx++) {
-      NextCallParamsText +=
-          (NextCallParamsText == "" ? "" : ", ") +
-          Printer.printStmt(CallExpr->getArg(ArgIdx),
-                            ASTCtx->getSourceManager(), RootDecl /* not used*/,
-                            "not-used", CallNode->getTraversalId(), HasCXXCall,
-                            HasCXXCall);
+      NextCallArgs.push_back(Printer.printStmt(
+          CallExpr->getArg(ArgIdx), ASTCtx->getSourceManager(),
+          RootDecl /* not used*/, "not-used", CallNode->getTraversalId(),
+          HasCXXCall, HasCXXCall));
     }
   }
 
-  NextCallParamsText += (NextCallParamsText == "" ? "AdjustedTruncateFlags"
-                                                  : ", AdjustedTruncateFlags");
+  NextCallArgs.push_back("AdjustedTruncateFlags");
+  if (opts::Parallel)
+    NextCallArgs.push_back("_depth + 1");
+
+  string NextCallParamsText;
+  for (auto &Arg : NextCallArgs)
+    NextCallParamsText += (NextCallParamsText == "" ? "" : ", ") + Arg;
+
+  string CallEnd = opts::UnfusedFallback ? "\n}\n}" : "\n}";
+
+  // A call to the function itself can jump back to its beginning with the
+  // parameters updated, TailCallText is used when nothing follows the call
+  if (TailCallText && opts::TailLoops && !HasVirtual &&
+      NextCallName == WriteBackInfo->FunctionName &&
+      WriteBackInfo->ParamsAssignable) {
+    assert(NextCallArgs.size() == WriteBackInfo->Params.size());
+    // the arguments are evaluated before any parameter is updated
+    string Update, TailArgs, TailFlags;
+    for (int i = 0; i < NextCallArgs.size(); i++) {
+      Update += "decltype(" + WriteBackInfo->Params[i].second + ") _tail" +
+                to_string(i) + " = " + NextCallArgs[i] + ";\n";
+      TailArgs += (TailArgs == "" ? "_tail" : ", _tail") + to_string(i);
+      if (WriteBackInfo->Params[i].second == "truncate_flags")
+        TailFlags = "_tail" + to_string(i);
+    }
+    // With -specialize-flags the clone of the active flags only loops while
+    // the flags stay the same, otherwise the call goes through the switch on
+    // the flags (once, the generic clone keeps looping)
+    string Jump;
+    if (opts::SpecializeFlags) {
+      assert(!TailFlags.empty());
+      Update += "if (_Mask && " + TailFlags + " != _Mask) {\n" + NextCallName +
+                "(" + TailArgs + ");\n} else {\n";
+      Jump = "}\n";
+    }
+    for (int i = 0; i < NextCallArgs.size(); i++) {
+      Update += WriteBackInfo->Params[i].second + " = _tail" + to_string(i) +
+                ";\n";
+    }
+    *TailCallText = CallPartText.substr(0, CallStart) + "{\n" + Update +
+                    "goto " + TailLabel + ";\n" + Jump + "}" + CallEnd;
+  }
+
+  // With -iterative a call to the function itself pushes the frame of the
+  // call and enters it, the current frame resumes after the call once the
+  // pushed frame is popped
+  if (WriteBackInfo->Iterative && !HasVirtual &&
+      NextCallName == WriteBackInfo->FunctionName) {
+    assert(NextCallArgs.size() == WriteBackInfo->Params.size());
+    WriteBackInfo->ResumePoints.push_back(WriteBackInfo->ResumePoints.size() +
+                                          1);
+    string ResumePoint = to_string(WriteBackInfo->ResumePoints.back());
+    // the arguments are evaluated before the push moves the frames
+    string Push, FrameArgs;
+    for (int i = 0; i < NextCallArgs.size(); i++) {
+      Push += "decltype(" + WriteBackInfo->Params[i].second + ") _arg" +
+              to_string(i) + " = " + NextCallArgs[i] + ";\n";
+      FrameArgs += "_arg" + to_string(i) + ", ";
+    }
+    Push += "_fr->_resume = " + ResumePoint + ";\n";
+    Push += "if (_stack.empty())\n_stack.reserve(" +
+            to_string(opts::IterativeStackReserve) + ");\n";
+    Push += "_stack.push_back(_Frame{" + FrameArgs + "0});\n";
+    CallPartText = CallPartText.substr(0, CallStart) + "{\n" + Push +
+                   "goto " + EnterLabel + ";\n}" + CallEnd + "\n" +
+                   ResumeLabel + ResumePoint + ":;\n";
+    return;
+  }
 
   CallPartText += NextCallParamsText;
   CallPartText += ");";
-  CallPartText += "\n}";
+  CallPartText += CallEnd;
   return;
 }
 
@@ -418,15 +652,14 @@ const clang::CXXRecordDecl *getHighestCommonTraversedType(
         extractDeclTraversedType(ParticipatingFunctions[i]);
     if (Candidate == HighestCommon)
       continue;
-    if (std::find(RecordsAnalyzer::DerivedRecords[HighestCommon].begin(),
-                  RecordsAnalyzer::DerivedRecords[HighestCommon].end(),
-                  Candidate) !=
-        RecordsAnalyzer::DerivedRecords[HighestCommon].end()) {
+    auto &HighestCommonDerived =
+        RecordsAnalyzer::getDerivedRecords(HighestCommon);
+    auto &CandidateDerived = RecordsAnalyzer::getDerivedRecords(Candidate);
+    if (std::find(HighestCommonDerived.begin(), HighestCommonDerived.end(),
+                  Candidate) != HighestCommonDerived.end()) {
       HighestCommon = Candidate;
-    } else if (std::find(RecordsAnalyzer::DerivedRecords[Candidate].begin(),
-                         RecordsAnalyzer::DerivedRecords[Candidate].end(),
-                         HighestCommon) !=
-               RecordsAnalyzer::DerivedRecords[Candidate].end()) {
+    } else if (std::find(CandidateDerived.begin(), CandidateDerived.end(),
+                         HighestCommon) != CandidateDerived.end()) {
       // do nothing
     } else {
       llvm_unreachable("not supposed to happen !");
@@ -434,6 +667,51 @@ const clang::CXXRecordDecl *getHighestCommonTraversedType(
   }
   return HighestCommon;
 }
+/// Return the nodes of the group of a node
+static std::vector<DG_Node *> getGroupNodes(DG_Node *Node) {
+  if (!Node->isMerged())
+    return {Node};
+  return std::vector<DG_Node *>(Node->getMergeInfo()->MergedNodes.begin(),
+                                Node->getMergeInfo()->MergedNodes.end());
+}
+
+bool TraversalSynthesizer::areDependentCalls(DG_Node *Call1, DG_Node *Call2) {
+  auto Group1 = getGroupNodes(Call1), Group2 = getGroupNodes(Call2);
+  for (auto *Node1 : Group1) {
+    for (auto *Node2 : Group2) {
+      if (Node1->getSuccessors().count(Node2) ||
+          Node2->getSuccessors().count(Node1))
+        return true;
+    }
+  }
+  return false;
+}
+
+std::string TraversalSynthesizer::getCallGroupText(
+    const std::vector<std::pair<DG_Node *, std::string>> &CallGroup) {
+  if (CallGroup.size() == 1)
+    return CallGroup[0].second;
+
+  // the last call runs on the current thread, the locals of the function are
+  // shared and outlive the tasks
+  string Split = "_depth < " + to_string(opts::ParallelDepth);
+  std::string Output;
+  if (opts::ParallelRuntime == opts::PR_Grafter) {
+    Output += "\n{\ngrafter::TaskGroup _tasks;\n";
+    for (int i = 0; i < CallGroup.size() - 1; i++)
+      Output += "_tasks.spawn([&]() {\n" + CallGroup[i].second + "\n}, " +
+                Split + ");\n";
+    Output += CallGroup.back().second + "\n_tasks.sync();\n}\n";
+    return Output;
+  }
+
+  for (int i = 0; i < CallGroup.size() - 1; i++)
+    Output += "\n#pragma omp task default(shared) if (" + Split + ")\n{\n" +
+              CallGroup[i].second + "\n}\n";
+  Output += CallGroup.back().second + "\n#pragma omp taskwait\n";
+  return Output;
+}
+
 void TraversalSynthesizer::generateWriteBackInfo(
     const std::vector<clang::CallExpr *> &ParticipatingCalls,
     const std::vector<DG_Node *> &ToplogicalOrder, bool HasVirtual,
@@ -473,6 +751,9 @@ void TraversalSynthesizer::generateWriteBackInfo(
 
   WriteBackInfo->ParticipatingCalls = ParticipatingCalls;
   WriteBackInfo->FunctionName = idName;
+  WriteBackInfo->ProfileKey =
+      FusionProfile::getFunctionKey(TraversalsDeclarationsList);
+  WriteBackInfo->TraversalsCount = TraversalsDeclarationsList.size();
 
   // create forward declaration
   WriteBackInfo->ForwardDeclaration = "void " + idName + "(";
@@ -483,6 +764,11 @@ void TraversalSynthesizer::generateWriteBackInfo(
       getHighestCommonTraversedType(TraversalsDeclarationsList)
           ->getNameAsString() +
       "*" + " _r";
+  WriteBackInfo->Params.push_back(std::make_pair(
+      getHighestCommonTraversedType(TraversalsDeclarationsList)
+              ->getNameAsString() +
+          "*",
+      "_r"));
 
   // append the arguments of each method and rename locals  by adding _fx_ only
   // participating traversals
@@ -496,13 +782,36 @@ void TraversalSynthesizer::generateWriteBackInfo(
         continue;
       }
 
+      if (Param->getType()->isReferenceType() ||
+          Param->getType().isConstQualified())
+        WriteBackInfo->ParamsAssignable = false;
       WriteBackInfo->ForwardDeclaration +=
           "," + string(Param->getType().getAsString()) + " _f" +
           to_string(Idx) + "_" + Param->getDeclName().getAsString();
+      WriteBackInfo->Params.push_back(
+          std::make_pair(string(Param->getType().getAsString()),
+                         "_f" + to_string(Idx) + "_" +
+                             Param->getDeclName().getAsString()));
     }
   }
 
-  WriteBackInfo->ForwardDeclaration += ", unsigned int truncate_flags)";
+  WriteBackInfo->ForwardDeclaration += ", unsigned int truncate_flags";
+  WriteBackInfo->Params.push_back(
+      std::make_pair(string("unsigned int"), string("truncate_flags")));
+
+  // the number of fused calls from the top level call, used to stop
+  // spawning tasks
+  if (opts::Parallel) {
+    WriteBackInfo->ForwardDeclaration += ", int _depth";
+    WriteBackInfo->Params.push_back(
+        std::make_pair(string("int"), string("_depth")));
+  }
+  WriteBackInfo->ForwardDeclaration += ")";
+
+  // the frames are copied from the parameters, the depth of -parallel is the
+  // depth of the native calls
+  WriteBackInfo->Iterative =
+      opts::Iterative && !opts::Parallel && WriteBackInfo->ParamsAssignable;
 
   string RootCasting = "";
   if (HasCXXCall) {
@@ -515,9 +824,17 @@ void TraversalSynthesizer::generateWriteBackInfo(
       else
         CastedToType = dyn_cast<clang::CXXMethodDecl>(Decl)->getParent();
 
-      RootCasting += CastedToType->getNameAsString() + " *" + string("_r") +
-                     "_f" + to_string(i) + " = " + "(" +
-                     CastedToType->getNameAsString() + "*)(_r);\n";
+      // the casted roots of -iterative functions are kept in the frames
+      string Name = string("_r") + "_f" + to_string(i);
+      if (WriteBackInfo->Iterative) {
+        WriteBackInfo->Locals.push_back(
+            std::make_pair(CastedToType->getNameAsString() + " *", Name));
+        RootCasting += Name + " = (" + CastedToType->getNameAsString() +
+                       "*)(_r);\n";
+        continue;
+      }
+      RootCasting += CastedToType->getNameAsString() + " *" + Name + " = " +
+                     "(" + CastedToType->getNameAsString() + "*)(_r);\n";
     }
   }
 
@@ -525,12 +842,30 @@ void TraversalSynthesizer::generateWriteBackInfo(
       "\n#ifdef COUNT_VISITS \n _VISIT_COUNTER++;\n #endif \n";
 
   WriteBackInfo->Body += VisitsCounting;
+  if (opts::FusionInstrument)
+    WriteBackInfo->Body += FusionProfile::getSiteText(
+        WriteBackInfo->ProfileKey, "_grafter_site_entry", {"entry"},
+        WriteBackInfo->TraversalsCount);
   WriteBackInfo->Body += RootCasting;
 
   unordered_map<int, vector<DG_Node *>> StamentsOderedByTId;
 
+  // the declarations of -iterative functions are added to their frames
+  auto *Locals = WriteBackInfo->Iterative ? &WriteBackInfo->Locals : nullptr;
+
   int CurBlockId = 0;
 
+  // Consecutive calls that do not depend on each other, with -parallel they
+  // are spawned as tasks and waited for before the next statements
+  std::vector<std::pair<DG_Node *, string>> CallGroup;
+  auto FlushCallGroup = [&]() {
+    WriteBackInfo->Body += getCallGroupText(CallGroup);
+    CallGroup.clear();
+  };
+
+  // the last call as a jump to the beginning of the function
+  string TailCallText;
+
   for (auto *DG_Node : ToplogicalOrder) {
     if (DG_Node->getStatementInfo()->isCallStmt()) {
       CurBlockId++;
@@ -539,15 +874,24 @@ void TraversalSynthesizer::generateWriteBackInfo(
 
       string blockSubPart = "";
       setBlockSubPart(/*Decls,*/ blockSubPart, TraversalsDeclarationsList,
-                      CurBlockId, StamentsOderedByTId, HasCXXCall);
-      WriteBackInfo->Body += blockSubPart;
+                      CurBlockId, StamentsOderedByTId, HasCXXCall, Locals);
 
       string CallPartText = "";
+      TailCallText = "";
       this->setCallPart(CallPartText, ParticipatingCalls,
                         TraversalsDeclarationsList, DG_Node, WriteBackInfo,
-                        HasCXXCall);
+                        HasCXXCall, &TailCallText);
+
+      bool Independent = opts::Parallel && blockSubPart.empty();
+      for (auto &Entry : CallGroup)
+        Independent = Independent && !areDependentCalls(Entry.first, DG_Node);
+      if (!Independent)
+        FlushCallGroup();
+
+      WriteBackInfo->Body += blockSubPart;
       // callect call expression (only for participating traversals)
-      WriteBackInfo->Body += CallPartText;
+      if (!CallPartText.empty())
+        CallGroup.push_back(std::make_pair(DG_Node, CallPartText));
 
       StamentsOderedByTId.clear();
     } else {
@@ -560,7 +904,16 @@ void TraversalSynthesizer::generateWriteBackInfo(
   string blockSubPart = "";
 
   this->setBlockSubPart(/*Decls, */ blockSubPart, TraversalsDeclarationsList,
-                        CurBlockId, StamentsOderedByTId, HasCXXCall);
+                        CurBlockId, StamentsOderedByTId, HasCXXCall, Locals);
+
+  // a last call that is not spawned and not followed by statements loops
+  bool TailLoop =
+      blockSubPart.empty() && CallGroup.size() == 1 && !TailCallText.empty();
+  if (TailLoop) {
+    CallGroup[0].second = TailCallText;
+    RunStatistics::count(RC_TailLoops);
+  }
+  FlushCallGroup();
 
   WriteBackInfo->Body += blockSubPart;
 
@@ -568,6 +921,14 @@ void TraversalSynthesizer::generateWriteBackInfo(
   // callect call expression (only for participating traversals)
   WriteBackInfo->Body += CallPartText;
   WriteBackInfo->Body = /* Decls + */ WriteBackInfo->Body;
+  if (TailLoop)
+    WriteBackInfo->Body = TailLabel + ":;\n" + WriteBackInfo->Body;
+
+  if (WriteBackInfo->Iterative)
+    setIterativeBody(WriteBackInfo);
+
+  if (opts::DedupFused)
+    deduplicate(WriteBackInfo);
 
   // string fullFun = "//****** this fused method is generated by PLCL\n " +
   //                  WriteBackInfo->ForwardDeclaration + "{\n" +
@@ -575,6 +936,344 @@ void TraversalSynthesizer::generateWriteBackInfo(
   //                  WriteBackInfo->Body + "\n}\n\n";
 }
 
+std::string TraversalSynthesizer::getFunctionDefinition(
+    FusedTraversalWritebackInfo *Info) {
+  // aliases are not emitted, their definition forwards to the shared function
+  // for the fusion cache
+  if (!Info->AliasOf.empty()) {
+    string Args;
+    for (auto &Param : Info->Params)
+      Args += (Args == "" ? "" : ", ") + Param.second;
+    return Info->ForwardDeclaration + "\n{\n" + Info->AliasOf + "(" + Args +
+           ");\n};\n";
+  }
+
+  if (!Info->CachedDefinition.empty())
+    return replaceAliases(Info->CachedDefinition);
+
+  string Body = replaceAliases(Info->Body);
+  if (!opts::SpecializeFlags)
+    return Info->ForwardDeclaration + "\n{\n" + Body + "\n};\n";
+
+  string SpecializedName = Info->FunctionName + "__spec";
+  string Params, Args;
+  for (auto &Param : Info->Params) {
+    Params += (Params == "" ? "" : ", ") + Param.first + " " + Param.second;
+    Args += (Args == "" ? "" : ", ") + Param.second;
+  }
+
+  // a non zero mask replaces the flags with a constant so that the compiler
+  // can fold the guards of the blocks
+  string Output = "template <unsigned int _Mask>\nvoid " + SpecializedName +
+                  "(" + Params + ")\n{\n" +
+                  "if (_Mask) truncate_flags = _Mask;\n" + Body +
+                  "\n};\n";
+
+  unsigned int AllActive = 0;
+  for (int i = 0; i < Info->TraversalsCount; i++)
+    AllActive |= (1 << i);
+
+  Output += Info->ForwardDeclaration + "\n{\n";
+  Output += "switch (truncate_flags) {\n";
+  Output += "case " + toBinaryString(AllActive) + ":\n";
+  Output += SpecializedName + "<" + toBinaryString(AllActive) + ">(" + Args +
+            ");\nreturn ;\n";
+  Output += "default:\n";
+  Output += SpecializedName + "<0>(" + Args + ");\nreturn ;\n";
+  Output += "}\n};\n";
+  return Output;
+}
+
+std::vector<FusedTraversalWritebackInfo *>
+TraversalSynthesizer::getFunctionClosure(const std::string &FunctionName) {
+  std::vector<FusedTraversalWritebackInfo *> Closure;
+  std::set<std::string> Visited;
+  std::vector<std::string> Worklist = {FunctionName};
+
+  while (!Worklist.empty()) {
+    std::string Name = Worklist.back();
+    Worklist.pop_back();
+    if (!SynthesizedFunctions.count(Name) || !Visited.insert(Name).second)
+      continue;
+
+    auto *Info = SynthesizedFunctions[Name];
+    Closure.push_back(Info);
+
+    // search for calls to the other synthesized functions, the definition
+    // of an alias calls the shared function
+    std::string Text = getFunctionDefinition(Info);
+    for (auto &Entry : SynthesizedFunctions) {
+      size_t Pos = Text.find(Entry.first);
+      while (Pos != std::string::npos) {
+        size_t End = Pos + Entry.first.size();
+        if (End == Text.size() || !(isalnum(Text[End]) || Text[End] == '_')) {
+          Worklist.push_back(Entry.first);
+          break;
+        }
+        Pos = Text.find(Entry.first, End);
+      }
+    }
+  }
+  return Closure;
+}
+
+void TraversalSynthesizer::addCachedFunction(
+    FusedTraversalWritebackInfo *Info) {
+  if (SynthesizedFunctions.count(Info->FunctionName)) {
+    delete Info;
+    return;
+  }
+  SynthesizedFunctions[Info->FunctionName] = Info;
+}
+
+/// Replace the occurrences of the identifier From in Text with To
+static std::string replaceIdentifier(std::string Text, const std::string &From,
+                                     const std::string &To) {
+  auto isIdentifierChar = [](char C) { return isalnum(C) || C == '_'; };
+  size_t Pos = Text.find(From);
+  while (Pos != std::string::npos) {
+    size_t End = Pos + From.size();
+    if ((Pos == 0 || !isIdentifierChar(Text[Pos - 1])) &&
+        (End == Text.size() || !isIdentifierChar(Text[End]))) {
+      Text.replace(Pos, From.size(), To);
+      End = Pos + To.size();
+    }
+    Pos = Text.find(From, End);
+  }
+  return Text;
+}
+
+void TraversalSynthesizer::canonicalizeCallOrder(
+    std::vector<DG_Node *> &CallNodes) {
+  if (CallNodes.size() < 2)
+    return;
+
+  // the order of the calls is the order of the fused traversals, it can only
+  // change if the calls are independent
+  for (int i = 0; i < CallNodes.size(); i++) {
+    for (int j = i + 1; j < CallNodes.size(); j++) {
+      if (CallNodes[i]->getSuccessors().count(CallNodes[j]) ||
+          CallNodes[j]->getSuccessors().count(CallNodes[i]))
+        return;
+    }
+  }
+
+  std::vector<std::pair<int, DG_Node *>> Keyed;
+  for (auto *Node : CallNodes) {
+    auto *Call = dyn_cast<clang::CallExpr>(Node->getStatementInfo()->Stmt);
+    auto *CalleeDecl = Call->getCalleeDecl()->getAsFunction()->getDefinition();
+
+    // the traversals called by virtual calls depend on the derived type
+    if (FunctionsFinder::getFunctionInfo(CalleeDecl)->isVirtual())
+      return;
+    createName(std::vector<clang::FunctionDecl *>{CalleeDecl});
+    Keyed.push_back(std::make_pair(getFunctionId(CalleeDecl), Node));
+  }
+
+  std::stable_sort(Keyed.begin(), Keyed.end(),
+                   [](const std::pair<int, DG_Node *> &A,
+                      const std::pair<int, DG_Node *> &B) {
+                     return A.first < B.first;
+                   });
+
+  bool Reordered = false;
+  for (int i = 0; i < CallNodes.size(); i++) {
+    Reordered |= CallNodes[i] != Keyed[i].second;
+    CallNodes[i] = Keyed[i].second;
+  }
+  if (Reordered)
+    RunStatistics::count(RC_ReorderedCalls);
+}
+
+std::string
+TraversalSynthesizer::getStructuralKey(FusedTraversalWritebackInfo *Info) {
+  static const std::string SelfName = "_fuse__self";
+  return replaceIdentifier(Info->ForwardDeclaration, Info->FunctionName,
+                           SelfName) +
+         "\n" +
+         replaceIdentifier(replaceAliases(Info->Body), Info->FunctionName,
+                           SelfName);
+}
+
+void TraversalSynthesizer::deduplicate(FusedTraversalWritebackInfo *Info) {
+  std::string Key = getStructuralKey(Info);
+  auto &Candidates = DefinitionHashes[std::hash<std::string>()(Key)];
+
+  // the key of a function is compared again, a hash collision or an alias
+  // added since it was hashed only miss a sharing
+  for (auto &Name : Candidates) {
+    if (getStructuralKey(SynthesizedFunctions[Name]) != Key)
+      continue;
+    LLVM_DEBUG(Logger::getStaticLogger().logInfo(
+        Info->FunctionName + " is identical to " + Name + "\n"));
+    Info->AliasOf = Name;
+    RunStatistics::count(RC_SharedFunctions);
+    return;
+  }
+  Candidates.push_back(Info->FunctionName);
+}
+
+std::string
+TraversalSynthesizer::resolveAlias(const std::string &FunctionName) {
+  auto It = SynthesizedFunctions.find(FunctionName);
+  if (It == SynthesizedFunctions.end() || It->second->AliasOf.empty())
+    return FunctionName;
+  return It->second->AliasOf;
+}
+
+std::string TraversalSynthesizer::replaceAliases(std::string Text) {
+  // a function that calls itself or a function generated after it refers to
+  // names that may have been aliased since
+  for (auto &Entry : SynthesizedFunctions) {
+    if (!Entry.second->AliasOf.empty())
+      Text = replaceIdentifier(Text, Entry.first, Entry.second->AliasOf);
+  }
+  return Text;
+}
+
+void TraversalSynthesizer::setIterativeBody(
+    FusedTraversalWritebackInfo *Info) {
+  // the resume point of a call turned into a tail loop is not reached
+  std::vector<int> ResumePoints;
+  for (int ResumePoint : Info->ResumePoints) {
+    if (Info->Body.find(ResumeLabel + to_string(ResumePoint) + ":") !=
+        std::string::npos)
+      ResumePoints.push_back(ResumePoint);
+  }
+  Info->ResumePoints = ResumePoints;
+
+  // without self calls the function keeps its locals on the call stack
+  if (ResumePoints.empty()) {
+    string Declarations;
+    for (auto &Local : Info->Locals)
+      Declarations += Local.first + " " + Local.second + ";\n";
+    Info->Body = Declarations + Info->Body;
+    return;
+  }
+  RunStatistics::count(RC_IterativeFunctions);
+
+  // the frame holds the parameters, the resume point and the locals, the
+  // locals are all kept since their liveness across the calls is not known
+  string Frame = "struct _Frame {\n";
+  string FrameArgs;
+  string Body = Info->Body;
+  for (auto &Param : Info->Params) {
+    Frame += Param.first + " " + Param.second + ";\n";
+    FrameArgs += Param.second + ", ";
+    Body = replaceIdentifier(Body, Param.second, "_fr->" + Param.second);
+  }
+  Frame += "int _resume;\n";
+  for (auto &Local : Info->Locals) {
+    Frame += Local.first + " " + Local.second + ";\n";
+    Body = replaceIdentifier(Body, Local.second, "_fr->" + Local.second);
+  }
+  Frame += "};\n";
+
+  // the end of the body pops the frame and resumes its caller, the frame of
+  // the entry is not on the stack
+  size_t ReturnPos = Body.rfind("return ;");
+  assert(ReturnPos != std::string::npos);
+  Body.replace(ReturnPos, string("return ;").size(),
+               "if (_stack.empty())\nreturn ;\n_stack.pop_back();\ngoto " +
+                   EnterLabel + ";");
+
+  // the stack only allocates at the first call, most entries of a traversal
+  // never reach one (the leaves)
+  string Enter = "_Frame _root{" + FrameArgs + "0};\n";
+  Enter += "std::vector<_Frame> _stack;\n";
+  Enter += "_Frame *_fr;\n" + EnterLabel + ":\n";
+  Enter += "_fr = _stack.empty() ? &_root : &_stack.back();\n";
+  Enter += "switch (_fr->_resume) {\n";
+  for (int ResumePoint : ResumePoints)
+    Enter += "case " + to_string(ResumePoint) + ":\ngoto " + ResumeLabel +
+             to_string(ResumePoint) + ";\n";
+  Enter += "}\n";
+
+  Info->Body = Frame + Enter + Body;
+}
+
+/// Return the offset after the last #include that precedes the first
+/// declaration of a file, an include within a conditional block is followed
+/// by the end of the block. The offset is 0 if there is no such include
+static size_t getIncludeInsertOffset(StringRef Buffer) {
+  size_t InsertOffset = 0;
+  int ConditionalDepth = 0;
+  int InsertDepth = 0;
+  bool InComment = false;
+  size_t Pos = 0;
+  while (Pos < Buffer.size()) {
+    size_t End = Buffer.find('\n', Pos);
+    End = End == StringRef::npos ? Buffer.size() : End + 1;
+    StringRef Line = Buffer.slice(Pos, End).trim();
+
+    // skip the comments at the beginning of the line
+    while (!Line.empty()) {
+      if (InComment) {
+        size_t Close = Line.find("*/");
+        if (Close == StringRef::npos) {
+          Line = StringRef();
+          break;
+        }
+        InComment = false;
+        Line = Line.substr(Close + 2).ltrim();
+      } else if (Line.startswith("//")) {
+        Line = StringRef();
+      } else if (Line.startswith("/*")) {
+        InComment = true;
+        Line = Line.substr(2);
+      } else {
+        break;
+      }
+    }
+
+    if (Line.empty()) {
+      Pos = End;
+      continue;
+    }
+
+    // the first declaration
+    if (!Line.startswith("#"))
+      break;
+
+    // a directive continues on the next line after a backslash
+    while (Buffer.slice(Pos, End).rtrim().endswith("\\") &&
+           End < Buffer.size()) {
+      Pos = End;
+      End = Buffer.find('\n', Pos);
+      End = End == StringRef::npos ? Buffer.size() : End + 1;
+    }
+
+    StringRef Directive = Line.substr(1).ltrim();
+    Directive = Directive.take_while([](char C) { return isalpha(C); });
+    if (Directive == "if" || Directive == "ifdef" || Directive == "ifndef") {
+      ConditionalDepth++;
+    } else if (Directive == "endif" && ConditionalDepth > 0) {
+      ConditionalDepth--;
+      if (InsertDepth > ConditionalDepth) {
+        InsertOffset = End;
+        InsertDepth = ConditionalDepth;
+      }
+    } else if (Directive == "include" || Directive == "import") {
+      InsertOffset = End;
+      InsertDepth = ConditionalDepth;
+    }
+    Pos = End;
+  }
+  return InsertOffset;
+}
+
+void TraversalSynthesizer::includeHeader(clang::FileID File,
+                                         const std::string &Header) {
+  auto &SM = ASTCtx->getSourceManager();
+  StringRef Buffer = SM.getBufferData(File);
+  size_t Offset = getIncludeInsertOffset(Buffer);
+  string Text = "#include " + Header + "\n";
+  if (Offset > 0 && Buffer[Offset - 1] != '\n')
+    Text = "\n" + Text;
+  Rewriter.InsertText(SM.getLocForStartOfFile(File).getLocWithOffset(Offset),
+                      Text);
+}
+
 extern AccessPath extractVisitedChild(clang::CallExpr *Call);
 
 void TraversalSynthesizer::WriteUpdates(
@@ -584,24 +1283,43 @@ void TraversalSynthesizer::WriteUpdates(
   for (auto *CallExpr : CallsExpressions)
     Rewriter.InsertText(CallExpr->getBeginLoc(), "//");
 
-  // add forward declarations
+  // the runtimes must precede the first synthesized function
+  auto InsertLoc =
+      EnclosingFunctionDecl->getTypeSourceInfo()->getTypeLoc().getBeginLoc();
+  if (opts::FusionInstrument &&
+      InstrumentedFiles
+          .insert(ASTCtx->getSourceManager().getFileID(InsertLoc))
+          .second)
+    Rewriter.InsertText(InsertLoc, FusionProfile::getRuntimeText());
+  bool UsesRuntime =
+      opts::Parallel && opts::ParallelRuntime == opts::PR_Grafter;
+  auto InsertFile = ASTCtx->getSourceManager().getFileID(InsertLoc);
+  if ((UsesRuntime || opts::Iterative) &&
+      RuntimeFiles.insert(InsertFile).second) {
+    // the stacks of -iterative are vectors
+    includeHeader(InsertFile, UsesRuntime ? "\"grafter_runtime.h\""
+                                          : "<vector>");
+  }
+
+  // add forward declarations, aliases are not emitted
   for (auto &SynthesizedFunction : SynthesizedFunctions) {
+    if (!SynthesizedFunction.second->AliasOf.empty())
+      continue;
     Rewriter.InsertText(
         EnclosingFunctionDecl->getTypeSourceInfo()->getTypeLoc().getBeginLoc(),
         (SynthesizedFunction.second->ForwardDeclaration) + string(";\n"));
   }
 
-  static std::set<string> InsertedFunctions;
-
   for (auto &SynthesizedFunction : SynthesizedFunctions) {
+    if (!SynthesizedFunction.second->AliasOf.empty())
+      continue;
     if(InsertedFunctions.count(SynthesizedFunction.second->FunctionName))
     continue;
     else 
     InsertedFunctions.insert(SynthesizedFunction.second->FunctionName);
     Rewriter.InsertText(
         EnclosingFunctionDecl->getTypeSourceInfo()->getTypeLoc().getBeginLoc(),
-        (SynthesizedFunction.second->ForwardDeclaration + "\n{\n" +
-         SynthesizedFunction.second->Body + "\n};\n"));
+        getFunctionDefinition(SynthesizedFunction.second));
   }
 
   StatementPrinter Printer;
@@ -622,7 +1340,7 @@ void TraversalSynthesizer::WriteUpdates(
   }
   std::string NextCallName;
   if (!HasVirtual)
-    NextCallName = createName(CallsExpressions, false, nullptr);
+    NextCallName = resolveAlias(createName(CallsExpressions, false, nullptr));
   else
     NextCallName = getVirtualStub(CallsExpressions);
 
@@ -647,7 +1365,14 @@ void TraversalSynthesizer::WriteUpdates(
 
   } else {
     if (CallsExpressions[0]->getStmtClass() ==
-        clang::Stmt::CXXMemberCallExprClass) {
+            clang::Stmt::CXXMemberCallExprClass &&
+        opts::Devirtualize) {
+      NewCall += NextCallName + "_dispatch(";
+      Params += Printer.printStmt(
+          CallsExpressions[0]->child_begin()->child_begin()->IgnoreImplicit(),
+          ASTCtx->getSourceManager(), nullptr, "", -1, false);
+    } else if (CallsExpressions[0]->getStmtClass() ==
+               clang::Stmt::CXXMemberCallExprClass) {
       NewCall += Printer.printStmt(CallsExpressions[0]
                                        ->child_begin()
                                        ->child_begin()
@@ -688,8 +1413,17 @@ void TraversalSynthesizer::WriteUpdates(
   for (int i = 0; i < CallsExpressions.size(); i++)
     x |= (1 << i);
 
-  Params += ((Params.size() == 0) ? "" : ", ") + toBinaryString(x) + ");";
+  Params += ((Params.size() == 0) ? "" : ", ") + toBinaryString(x);
+  if (opts::Parallel)
+    Params += ", 0";
+  Params += ");";
   NewCall += Params;
+
+  // the tasks of the fused traversals run on the threads of a parallel region
+  if (opts::Parallel && opts::ParallelRuntime == opts::PR_Grafter)
+    NewCall = "grafter::run([&]() {\n" + NewCall + "\n});";
+  else if (opts::Parallel)
+    NewCall = "\n#pragma omp parallel\n#pragma omp single\n" + NewCall;
   Rewriter.InsertTextAfter(
       Lexer::findLocationAfterToken(
           CallsExpressions[CallsExpressions.size() - 1]->getLocEnd(),
@@ -752,6 +1486,10 @@ void TraversalSynthesizer::WriteUpdates(
     Params +=
         (Params == "" ? "" : ", ") + string("unsigned int truncate_flags");
     Args += ", truncate_flags";
+    if (opts::Parallel) {
+      Params += ", int _depth";
+      Args += ", _depth";
+    }
     auto LambdaFun = [&](const CXXRecordDecl *DerivedType) {
       if (InsertedStubs[DerivedType].count(Entry.second))
         return;
@@ -772,18 +1510,198 @@ void TraversalSynthesizer::WriteUpdates(
                                    .getBeginLoc(),
                                "void " + DerivedType->getNameAsString() +
                                    "::" + StubName + "(" + Params + "){" +
-                                   createName(Calls, true, DerivedType) + "(" +
-                                   Args +
+                                   resolveAlias(createName(
+                                       Calls, true, DerivedType)) +
+                                   "(" + Args +
                                    ");"
                                    "}\n");
 
       return;
     };
     LambdaFun(CalledChildType);
-    for (auto *DerivedType : RecordsAnalyzer::DerivedRecords[CalledChildType]) {
+    for (auto *DerivedType :
+         RecordsAnalyzer::getDerivedRecords(CalledChildType)) {
       LambdaFun(DerivedType);
     }
+
+    if (opts::Devirtualize)
+      addTagDispatch(Calls, StubName, CalledChildType, Params, Args,
+                     EnclosingFunctionDecl);
+  }
+}
+
+/// Return the root of the tree hierarchy of a class, the class that stores
+/// the tag. The bases that are not tree structures (mixins) are skipped, null
+/// if a class of the chain has several tree bases or a virtual one
+static const CXXRecordDecl *getHierarchyRoot(const CXXRecordDecl *Type) {
+  while (true) {
+    const CXXRecordDecl *TreeBase = nullptr;
+    for (auto &Base : Type->bases()) {
+      auto *BaseDecl = Base.getType()->getAsCXXRecordDecl();
+      if (BaseDecl == nullptr || !hasTreeAnnotation(BaseDecl))
+        continue;
+      if (TreeBase != nullptr || Base.isVirtual())
+        return nullptr;
+      TreeBase = BaseDecl;
+    }
+    if (TreeBase == nullptr)
+      return Type;
+    Type = TreeBase;
+  }
+}
+
+/// Return the root of the hierarchy of a class if each class of the
+/// hierarchy reaches it through a single chain of tree bases, null otherwise
+static const CXXRecordDecl *getTaggedRoot(const CXXRecordDecl *Type) {
+  auto *Root = getHierarchyRoot(Type);
+  if (Root == nullptr)
+    return nullptr;
+  for (auto *Derived : RecordsAnalyzer::getDerivedRecords(Root))
+    if (getHierarchyRoot(Derived) != Root)
+      return nullptr;
+  return Root;
+}
+
+std::string TraversalSynthesizer::getTypeTag(const CXXRecordDecl *Type) {
+  if (opts::DevirtualizeTagField.empty()) {
+    // the tag is the rank of the qualified name within the hierarchy, it does
+    // not depend on the order in which the contexts use the classes
+    auto *Root = getHierarchyRoot(Type);
+    assert(Root && "the hierarchy of a tagged class has a single root");
+    std::vector<std::string> Names = {Root->getQualifiedNameAsString()};
+    for (auto *Derived : RecordsAnalyzer::getDerivedRecords(Root))
+      Names.push_back(Derived->getQualifiedNameAsString());
+    std::sort(Names.begin(), Names.end());
+    Names.erase(std::unique(Names.begin(), Names.end()), Names.end());
+    auto It = std::lower_bound(Names.begin(), Names.end(),
+                               Type->getQualifiedNameAsString());
+    assert(It != Names.end() && *It == Type->getQualifiedNameAsString() &&
+           "the class is not in the hierarchy of its root");
+    return to_string(It - Names.begin());
+  }
+
+  for (auto &Entry : opts::DevirtualizeTags) {
+    StringRef Class, Value;
+    std::tie(Class, Value) = StringRef(Entry).split('=');
+    if (Class == Type->getNameAsString() ||
+        Class == Type->getQualifiedNameAsString())
+      return Value.str();
+  }
+  return "";
+}
+
+void TraversalSynthesizer::addTagFields(const CXXRecordDecl *Root) {
+  if (!TaggedRecords.insert(Root).second)
+    return;
+
+  // Copies do not carry the tag: an assignment through a reference to a base
+  // would store the tag of another class in the object, and a copy sliced to
+  // a base would keep the tag of the derived class. A copy constructed object
+  // has no tag and goes through the virtual stub
+  Rewriter.InsertText(
+      Root->getDefinition()->getLocEnd(),
+      "public:\nstruct " + TagFieldName + "_t {\nint Value = -1;\n" +
+          TagFieldName + "_t() = default;\n" + TagFieldName + "_t(const " +
+          TagFieldName + "_t &) {}\n" + TagFieldName +
+          "_t &operator=(const " + TagFieldName +
+          "_t &) { return *this; }\n} " + TagFieldName + ";\n");
+
+  // the setter of a class is initialized after the ones of its bases, the
+  // tag is the one of the dynamic type once the object is constructed
+  std::vector<const CXXRecordDecl *> Types = {Root};
+  for (auto *Derived : RecordsAnalyzer::getDerivedRecords(Root))
+    if (std::find(Types.begin(), Types.end(), Derived) == Types.end())
+      Types.push_back(Derived);
+  for (auto *Tagged : Types) {
+    Rewriter.InsertText(
+        Tagged->getDefinition()->getLocEnd(),
+        "public:\nstruct " + TagFieldName + "_setter {\n" + TagFieldName +
+            "_setter(" + Root->getNameAsString() + " *_r) { _r->" +
+            TagFieldName + ".Value = " + getTypeTag(Tagged) + "; }\n} " +
+            TagFieldName + "_set{this};\n");
+  }
+}
+
+void TraversalSynthesizer::addTagDispatch(
+    const std::vector<clang::CallExpr *> &Calls, const std::string &StubName,
+    const CXXRecordDecl *CalledChildType, const std::string &Params,
+    const std::string &Args, clang::FunctionDecl *EnclosingFunctionDecl) {
+  if (!InsertedDispatches.insert(StubName).second)
+    return;
+
+  // the arguments of the stub start with the receiver
+  string Receiver = "this, ";
+  assert(Args.compare(0, Receiver.size(), Receiver) == 0);
+  string StubArgs = Args.substr(Receiver.size());
+
+  string Signature = "inline void " + StubName + "_dispatch(" +
+                     CalledChildType->getNameAsString() + " *_r, " + Params +
+                     ")";
+  string StubCall = "_r->" + StubName + "(" + StubArgs + ");\n";
+
+  string TagField = opts::DevirtualizeTagField;
+  if (TagField.empty()) {
+    // the tag of a class is set through a pointer to the root, the classes
+    // of a hierarchy with several or virtual tree bases keep the stub
+    auto *Root = getTaggedRoot(CalledChildType);
+    if (Root == nullptr) {
+      Logger::getStaticLogger().logWarn(
+          "-devirtualize: the hierarchy of " +
+          CalledChildType->getQualifiedNameAsString() +
+          " has multiple or virtual tree bases, " + StubName +
+          " is not devirtualized");
+      addDispatchDefinition(Signature, StubCall, EnclosingFunctionDecl);
+      return;
+    }
+    addTagFields(Root);
+    TagField = TagFieldName + ".Value";
+  }
+
+  string Body = "switch (_r->" + TagField + ") {\n";
+
+  // a class derived from the traversed class through several paths is listed
+  // once per path
+  std::vector<const CXXRecordDecl *> Types = {CalledChildType};
+  for (auto *Derived : RecordsAnalyzer::getDerivedRecords(CalledChildType))
+    if (std::find(Types.begin(), Types.end(), Derived) == Types.end())
+      Types.push_back(Derived);
+  for (auto *Type : Types) {
+    string Tag = getTypeTag(Type);
+    if (Type->isAbstract() || Tag.empty())
+      continue;
+    Body += "case " + Tag + ":\n" +
+            resolveAlias(createName(Calls, true, Type)) + "(static_cast<" +
+            Type->getNameAsString() + " *>(_r), " + StubArgs + ");\nreturn;\n";
+  }
+  // objects of the classes without a tag
+  Body += "default:\n" + StubCall + "}\n";
+
+  addDispatchDefinition(Signature, Body, EnclosingFunctionDecl);
+}
+
+void TraversalSynthesizer::addDispatchDefinition(
+    const std::string &Signature, const std::string &Body,
+    clang::FunctionDecl *EnclosingFunctionDecl) {
+  // the synthesized functions that call the dispatch function precede its
+  // definition
+  auto InsertLoc = EnclosingFunctionDecl->getAsFunction()
+                       ->getDefinition()
+                       ->getTypeSourceInfo()
+                       ->getTypeLoc()
+                       .getBeginLoc();
+  Rewriter.InsertTextBefore(InsertLoc, Signature + ";\n");
+  Rewriter.InsertTextAfter(InsertLoc, Signature + " {\n" + Body + "}\n");
+}
+
+void StatementPrinter::print_handleBodyStmt(const clang::Stmt *Stmt,
+                                            SourceManager &SM) {
+  if (!isa<clang::Expr>(Stmt)) {
+    print_handleStmt(Stmt, SM);
+    return;
   }
+  Output += "\t";
+  print_handleStmt(Stmt, SM);
+  Output += ";\n";
 }
 
 void StatementPrinter::print_handleStmt(const clang::Stmt *Stmt,
@@ -793,7 +1711,7 @@ void StatementPrinter::print_handleStmt(const clang::Stmt *Stmt,
 
   case Stmt::CompoundStmtClass: {
     for (auto *ChildStmt : Stmt->children())
-      print_handleStmt(ChildStmt, SM);
+      print_handleBodyStmt(ChildStmt, SM);
     break;
   }
   case Stmt::CallExprClass: {
@@ -809,18 +1727,12 @@ void StatementPrinter::print_handleStmt(const clang::Stmt *Stmt,
       }
     }
     Output += ")";
-
-    if (NestedExpressionDepth == 0)
-      Output += ";";
     break;
   }
-  case Stmt::BinaryOperatorClass: {
+  case Stmt::BinaryOperatorClass:
+  case Stmt::CompoundAssignOperatorClass: {
     // print the lhs ,
-    NestedExpressionDepth++;
     auto *BinaryOperator = dyn_cast<clang::BinaryOperator>(Stmt);
-
-    if (BinaryOperator->isAssignmentOp())
-      Output += "\t";
     print_handleStmt(BinaryOperator->getLHS(), SM);
 
     // print op
@@ -828,10 +1740,6 @@ void StatementPrinter::print_handleStmt(const clang::Stmt *Stmt,
 
     // print lhs
     print_handleStmt(BinaryOperator->getRHS(), SM);
-    if (BinaryOperator->isAssignmentOp())
-      Output += ";\n";
-
-    NestedExpressionDepth--;
     break;
   }
   case Stmt::DeclRefExprClass: {
@@ -869,18 +1777,16 @@ void StatementPrinter::print_handleStmt(const clang::Stmt *Stmt,
     auto &IfStmt = *dyn_cast<clang::IfStmt>(Stmt);
     // check the condition part first
     if (IfStmt.getCond() != nullptr) {
-      NestedExpressionDepth++;
       Output += "\t if (";
       auto *IfStmtCondition = IfStmt.getCond()->IgnoreImplicit();
       print_handleStmt(IfStmtCondition, SM);
       Output += ")";
-      NestedExpressionDepth--;
     }
 
     if (IfStmt.getThen() != nullptr) {
       auto *IfStmtThenPart = IfStmt.getThen()->IgnoreImplicit();
       Output += "{\n";
-      print_handleStmt(IfStmtThenPart, SM);
+      print_handleBodyStmt(IfStmtThenPart, SM);
       Output += "\t}";
     } else {
       Output += "{}\n";
@@ -889,7 +1795,7 @@ void StatementPrinter::print_handleStmt(const clang::Stmt *Stmt,
     if (IfStmt.getElse() != nullptr) {
       auto *IfStmtElsePart = IfStmt.getElse()->IgnoreImplicit();
       Output += "else {\n\t";
-      print_handleStmt(IfStmtElsePart, SM);
+      print_handleBodyStmt(IfStmtElsePart, SM);
       Output += "\n\t}";
     } else {
       Output += "\n";
@@ -947,8 +1853,6 @@ void StatementPrinter::print_handleStmt(const clang::Stmt *Stmt,
       }
     }
     Output += ")";
-    if (NestedExpressionDepth == 0)
-      Output += ";";
     break;
   }
   case Stmt::CXXStaticCastExprClass: {
@@ -963,7 +1867,6 @@ void StatementPrinter::print_handleStmt(const clang::Stmt *Stmt,
     auto *DeleteArgument = dyn_cast<CXXDeleteExpr>(Stmt)->getArgument();
     Output += "delete ";
     print_handleStmt(DeleteArgument, SM);
-    Output += ";";
     break;
   }
   case Stmt::CXXThisExprClass: {
@@ -977,10 +1880,59 @@ void StatementPrinter::print_handleStmt(const clang::Stmt *Stmt,
   }
   case Stmt::UnaryOperatorClass: {
     auto *UnaryOpExp = dyn_cast<clang::UnaryOperator>(Stmt);
-    Output += UnaryOpExp->getOpcodeStr(UnaryOpExp->getOpcode()).str();
+    if (!UnaryOpExp->isPostfix())
+      Output += UnaryOpExp->getOpcodeStr(UnaryOpExp->getOpcode()).str();
     print_handleStmt(UnaryOpExp->getSubExpr(), SM);
+    if (UnaryOpExp->isPostfix())
+      Output += UnaryOpExp->getOpcodeStr(UnaryOpExp->getOpcode()).str();
     break;
   }
+  case Stmt::ForStmtClass: {
+    auto *ForStmt = dyn_cast<clang::ForStmt>(Stmt);
+    Output += "\t for (";
+    if (ForStmt->getInit() != nullptr) {
+      // declarations print their own terminator
+      print_handleStmt(ForStmt->getInit(), SM);
+      if (!isa<clang::DeclStmt>(ForStmt->getInit()))
+        Output += ";";
+    } else
+      Output += ";";
+
+    if (ForStmt->getCond() != nullptr)
+      print_handleStmt(ForStmt->getCond(), SM);
+    Output += ";";
+    if (ForStmt->getInc() != nullptr)
+      print_handleStmt(ForStmt->getInc(), SM);
+
+    Output += ") {\n";
+    print_handleBodyStmt(ForStmt->getBody(), SM);
+    Output += "\t}\n";
+    break;
+  }
+  case Stmt::WhileStmtClass: {
+    auto *WhileStmt = dyn_cast<clang::WhileStmt>(Stmt);
+    Output += "\t while (";
+    print_handleStmt(WhileStmt->getCond(), SM);
+    Output += ") {\n";
+    print_handleBodyStmt(WhileStmt->getBody(), SM);
+    Output += "\t}\n";
+    break;
+  }
+  case Stmt::DoStmtClass: {
+    auto *DoStmt = dyn_cast<clang::DoStmt>(Stmt);
+    Output += "\t do {\n";
+    print_handleBodyStmt(DoStmt->getBody(), SM);
+    Output += "\t} while (";
+    print_handleStmt(DoStmt->getCond(), SM);
+    Output += ");\n";
+    break;
+  }
+  case Stmt::BreakStmtClass:
+    Output += "\t break;\n";
+    break;
+  case Stmt::ContinueStmtClass:
+    Output += "\t continue;\n";
+    break;
   case Stmt::IntegerLiteralClass: {
     auto *IntegerLit = dyn_cast<clang::IntegerLiteral>(Stmt);
     Output += IntegerLit->getValue().toString(10, true);
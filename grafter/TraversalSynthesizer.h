@@ -18,6 +18,7 @@
 #include "FunctionsFinder.h"
 #include "LLVMDependencies.h"
 #include <FuseTransformation.h>
+#include <atomic>
 #include <set>
 #include <stdio.h>
 #include <unordered_map>
@@ -28,6 +29,8 @@ class StatementPrinter;
 class FusionTransformer;
 
 class TraversalSynthesizer {
+  friend class FusionCache;
+
 private:
   static std::map<clang::FunctionDecl *, int> FunDeclToNameId;
   static int Count;
@@ -46,6 +49,33 @@ private:
   /// Clang source code rewriter for the associated AST
   clang::Rewriter &Rewriter;
 
+  /// Virtual stubs of the context, they are added to the traversed classes
+  std::map<std::vector<clang::CallExpr *>, string> Stubs;
+
+  /// Stubs already added to each class
+  std::unordered_map<const CXXRecordDecl *, std::set<std::string>>
+      InsertedStubs;
+
+  /// Synthesized functions whose definition is already added
+  std::set<string> InsertedFunctions;
+
+  /// Files where the profiling runtime is already added
+  std::set<clang::FileID> InstrumentedFiles;
+
+  /// Files where the runtime header of -parallel or -iterative is already
+  /// included
+  std::set<clang::FileID> RuntimeFiles;
+
+  /// Virtual stubs whose tag dispatch function is already added
+  std::set<std::string> InsertedDispatches;
+
+  /// Roots of the hierarchies where the tag field is already added
+  std::set<const CXXRecordDecl *> TaggedRecords;
+
+  /// Maps the hash of the structural key of the emitted synthesized functions
+  /// to their names, used to share identical functions (-dedup-fused)
+  std::unordered_map<size_t, std::vector<std::string>> DefinitionHashes;
+
   /// Return a unique id assigned to each function declaration
   int getFunctionId(clang::FunctionDecl *);
 
@@ -57,32 +87,109 @@ private:
   unsigned getNumberOfParticipatingTraversals(
       const std::vector<bool> &ParticipatingTraversals) const;
 
+  /// Set the text of the statements of a block, the top level declarations
+  /// are moved before the block, or added to Locals when it is given
   void setBlockSubPart(
       std::string &BlockPart,
       const std::vector<clang::FunctionDecl *> &ParticipatingTraversals,
       int BlockId, std::unordered_map<int, vector<DG_Node *>> &Statements,
-      bool HasCXXCall);
+      bool HasCXXCall,
+      std::vector<std::pair<std::string, std::string>> *Locals = nullptr);
 
-  ///
+  /// Set the text of a call node, if the call is to the function itself and
+  /// TailCallText is given it is set to the text of the call as a jump to
+  /// the beginning of the function
   void setCallPart(
       std::string &CallPartText,
       const std::vector<clang::CallExpr *> &ParticipatingCallExpr,
       const std::vector<clang::FunctionDecl *> &ParticipatingTraversalsDecl,
       DG_Node *CallNode, FusedTraversalWritebackInfo *WriteBackInfo,
-      bool HasCXXCall);
+      bool HasCXXCall, std::string *TailCallText = nullptr);
+
+  /// Return the tag of the objects of a class for -devirtualize, empty if the
+  /// class has no tag
+  std::string getTypeTag(const CXXRecordDecl *Type);
+
+  /// Add the tag field to the root of a hierarchy, and to each class of the
+  /// hierarchy a member that sets the tag on construction
+  void addTagFields(const CXXRecordDecl *Root);
+
+  /// Add a function that dispatches the calls of a virtual stub with a switch
+  /// on the type tag, the fused functions of the derived classes are called
+  /// directly and can be inlined
+  void addTagDispatch(const std::vector<clang::CallExpr *> &Calls,
+                      const std::string &StubName,
+                      const CXXRecordDecl *CalledChildType,
+                      const std::string &Params, const std::string &Args,
+                      clang::FunctionDecl *EnclosingFunctionDecl);
+
+  /// Add the definition of a dispatch function before the enclosing function
+  void addDispatchDefinition(const std::string &Signature,
+                             const std::string &Body,
+                             clang::FunctionDecl *EnclosingFunctionDecl);
+
+  /// Make the body of an -iterative function run its self calls on an
+  /// explicit stack of frames, the parameters and locals are accessed through
+  /// the current frame
+  void setIterativeBody(FusedTraversalWritebackInfo *Info);
+
+  /// Return true if a dependence exists between the groups of the two call
+  /// nodes, the calls can then not run in parallel
+  bool areDependentCalls(DG_Node *Call1, DG_Node *Call2);
+
+  /// Return the text of consecutive call parts, with -parallel and more than
+  /// one call all but the last are spawned as tasks and waited for
+  std::string getCallGroupText(
+      const std::vector<std::pair<DG_Node *, std::string>> &CallGroup);
 
   /// Return true if a subtraversal with the given participating traversal
   /// is already synthesized
   bool
   isGenerated(const vector<clang::FunctionDecl *> &ParticipatingTraversals);
 
-public:
-  static std::map<std::vector<clang::CallExpr *>, string> Stubs;
+  /// Return the definition of a synthesized function, with -specialize-flags
+  /// the body is a template on the truncate flags called through a switch
+  /// on the flags
+  std::string getFunctionDefinition(FusedTraversalWritebackInfo *Info);
+
+  /// Return the synthesized function with the given name followed by the
+  /// synthesized functions it calls (transitively)
+  std::vector<FusedTraversalWritebackInfo *>
+  getFunctionClosure(const std::string &FunctionName);
+
+  /// Add a function read from the fusion cache unless it is already
+  /// synthesized
+  void addCachedFunction(FusedTraversalWritebackInfo *Info);
+
+  /// Order the merged call nodes by the ids of their callees when the calls
+  /// do not depend on each other, so that a set of traversals is always fused
+  /// under the same name
+  void canonicalizeCallOrder(std::vector<DG_Node *> &CallNodes);
 
+  /// Return the definition text of a synthesized function with its own name
+  /// abstracted, two functions with the same key are interchangeable
+  std::string getStructuralKey(FusedTraversalWritebackInfo *Info);
+
+  /// Make the function an alias of an identical function synthesized before
+  void deduplicate(FusedTraversalWritebackInfo *Info);
+
+  /// Return the name of the function that replaces the given synthesized
+  /// function
+  std::string resolveAlias(const std::string &FunctionName);
+
+  /// Replace the calls to aliased functions in the text
+  std::string replaceAliases(std::string Text);
+
+  /// Include a header after the last top-level include of a file, an
+  /// include at the enclosing function could land inside a namespace
+  void includeHeader(clang::FileID File, const std::string &Header);
+
+public:
   // TODO: Make this better
-  static string getVirtualStub(
+  string getVirtualStub(
       const std::vector<clang::CallExpr *> &ParticipatingTraversals) {
-    static int StubsCount = 0;
+    // stub names are unique across the contexts
+    static std::atomic<int> StubsCount(0);
     if (Stubs.count(ParticipatingTraversals))
       return Stubs[ParticipatingTraversals];
     else
@@ -135,12 +242,14 @@ private:
 
   int TraversalIndex;
 
-  /// Variable used to track the depth of nested expressions
-  int NestedExpressionDepth = 0;
-
-  /// Inner call that performs actual text generation
+  /// Inner call that performs actual text generation, expressions are
+  /// printed without a terminator
   void print_handleStmt(const clang::Stmt *Stmt, SourceManager &SM);
 
+  /// Print a statement of a body, an expression is printed as an expression
+  /// statement
+  void print_handleBodyStmt(const clang::Stmt *Stmt, SourceManager &SM);
+
   /// Wether the printer should use _r_f(TraversalId) instead of _r for the
   /// rootNode
   bool RootCasedPerTraversals = false;
@@ -148,12 +257,9 @@ private:
   /// The number of the traversals in the synthesized function
   int TraversalsCount;
 
-  static std::unordered_map<const CXXRecordDecl *, std::set<std::string>>
-      InsertedStubs;
-
 public:
-  /// Return a new string for the given statement that is used in the new
-  /// synthesized traversal
+  /// Return a new string for the given statement or expression that is used
+  /// in the new synthesized traversal, an expression is not terminated
   std::string printStmt(const clang::Stmt *Stmt, SourceManager &SM,
                         clang::ValueDecl *RootDecl, string NextLabel,
                         int TraversalIndex_, bool ReplaceThis_ = true,
@@ -163,7 +269,6 @@ public:
     this->RootNodeDecl = RootDecl;
     this->NextLabel = NextLabel;
     this->TraversalIndex = TraversalIndex_;
-    this->NestedExpressionDepth = 0;
     this->ReplaceThis = ReplaceThis_;
     this->RootCasedPerTraversals = RootCasedPerTraversals_;
     this->TraversalsCount = TraversalsCount_;
@@ -171,6 +276,20 @@ public:
     return Output;
   }
 
+  /// Return a new string for the given statement of a traversal body, an
+  /// expression is printed as an expression statement
+  std::string printBodyStmt(const clang::Stmt *Stmt, SourceManager &SM,
+                            clang::ValueDecl *RootDecl, string NextLabel,
+                            int TraversalIndex_, bool ReplaceThis_ = true,
+                            bool RootCasedPerTraversals_ = false,
+                            int TraversalsCount_ = 10) {
+    printStmt(Stmt, SM, RootDecl, NextLabel, TraversalIndex_, ReplaceThis_,
+              RootCasedPerTraversals_, TraversalsCount_);
+    if (isa<clang::Expr>(Stmt))
+      Output = "\t" + Output + ";\n";
+    return Output;
+  }
+
   /// Return the string representation for clang statement without modifying it
   std::string stmtTostr(const clang::Stmt *Stmt, const SourceManager &SM) {
     string Output = Lexer::getSourceText(
@@ -190,6 +309,29 @@ public:
   std::string ForwardDeclaration;
   std::string FunctionName;
   std::vector<clang::CallExpr *> ParticipatingCalls;
+  /// The (type, name) of the parameters of the function in order, they end
+  /// with the truncate flags (followed by the call depth with -parallel)
+  std::vector<std::pair<std::string, std::string>> Params;
+  /// Identifies the function in the fusion profile
+  std::string ProfileKey;
+  /// Number of participating traversals (width of the truncate flags)
+  unsigned TraversalsCount = 0;
+  /// The complete definition when read from the fusion cache
+  std::string CachedDefinition;
+  /// The identical function that is emitted instead of this one, empty if the
+  /// function is emitted
+  std::string AliasOf;
+  /// No parameter is a reference or const, a call to the function itself
+  /// can be replaced by assignments to the parameters
+  bool ParamsAssignable = true;
+  /// The calls to the function itself push a frame on an explicit stack
+  /// instead of growing the native stack (-iterative)
+  bool Iterative = false;
+  /// The (type, name) of the locals declared at the top level of the body,
+  /// with -iterative they are kept in the frames
+  std::vector<std::pair<std::string, std::string>> Locals;
+  /// The resume points of the self calls with -iterative
+  std::vector<int> ResumePoints;
 };
 
 #endif
@@ -0,0 +1,452 @@
+//===--- grafter_runtime.h ------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// A header only work-stealing runtime for the parallel traversals synthesized
+// with -parallel -parallel-runtime=grafter, it only depends on the standard
+// library and can also be used by the drivers of the benchmarks:
+//
+//   grafter::run([&]() {
+//     grafter::TaskGroup Tasks;
+//     Tasks.spawn([&]() { traverse(Node->Left); });
+//     traverse(Node->Right);
+//     Tasks.sync();
+//   });
+//
+// Each worker owns a Chase-Lev deque, it pushes and pops its tasks at the
+// bottom while idle workers steal from the top. The tasks of a group live in
+// the group itself (on the stack of the spawning function), spawning does not
+// allocate. A task is run inline when it is not worth splitting (the spawn
+// condition is false), when the worker already has GRAFTER_GRAIN tasks
+// queued, or when the closure does not fit in a task.
+//
+// Environment variables:
+//   GRAFTER_NUM_THREADS  number of workers (default: hardware concurrency)
+//   GRAFTER_GRAIN        maximum number of tasks queued per worker (64)
+//   GRAFTER_STATS        print the statistics of the workers at exit
+//===----------------------------------------------------------------------===//
+
+#ifndef GRAFTER_RUNTIME_H
+#define GRAFTER_RUNTIME_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace grafter {
+
+class TaskGroup;
+
+/// A spawned closure, its storage is inline so that small closures (the
+/// lambdas capturing by reference of the synthesized code, a pointer per
+/// captured variable) do not allocate
+struct Task {
+  static const std::size_t StorageSize = 128;
+
+  void (*Run)(Task *);
+  TaskGroup *Group;
+  alignas(std::max_align_t) unsigned char Storage[StorageSize];
+};
+
+/// The counters of a worker, only updated by their worker
+struct WorkerStatistics {
+  std::atomic<unsigned long> Spawned{0};
+  std::atomic<unsigned long> Inlined{0};
+  std::atomic<unsigned long> Executed{0};
+  std::atomic<unsigned long> Stolen{0};
+  std::atomic<unsigned long> FailedSteals{0};
+
+  static void bump(std::atomic<unsigned long> &Counter) {
+    Counter.store(Counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+  }
+};
+
+/// A fixed capacity Chase-Lev deque, the owner pushes and pops at the bottom
+/// and the thieves steal at the top. The indices are accessed with sequentially
+/// consistent operations instead of the fences of the C11 version of Le et
+/// al., ThreadSanitizer does not model standalone fences. A thief that loads
+/// the bottom synchronizes with the push of the task it steals
+class Deque {
+public:
+  static const long Capacity = 1 << 12;
+
+private:
+  static const long Mask = Capacity - 1;
+
+  // the indices are padded to separate cache lines, the thieves only write
+  // the top. Padding instead of alignas keeps the workers allocatable with
+  // the new of C++11
+  char PadBefore[64];
+  std::atomic<long> Top{0};
+  char PadBetween[64];
+  std::atomic<long> Bottom{0};
+  char PadAfter[64];
+  std::atomic<Task *> Buffer[Capacity];
+
+public:
+  /// Return the number of queued tasks, exact for the owner
+  long size() const {
+    long Size = Bottom.load(std::memory_order_relaxed) -
+                Top.load(std::memory_order_relaxed);
+    return Size < 0 ? 0 : Size;
+  }
+
+  /// Push a task, return false if the deque is full
+  bool push(Task *T) {
+    long B = Bottom.load(std::memory_order_relaxed);
+    long Tp = Top.load(std::memory_order_acquire);
+    if (B - Tp >= Capacity)
+      return false;
+    Buffer[B & Mask].store(T, std::memory_order_relaxed);
+    Bottom.store(B + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Return the last pushed task without removing it, only called by the
+  /// owner. The task may be stolen meanwhile
+  Task *peek() const {
+    long B = Bottom.load(std::memory_order_relaxed);
+    if (B - Top.load(std::memory_order_acquire) <= 0)
+      return nullptr;
+    return Buffer[(B - 1) & Mask].load(std::memory_order_relaxed);
+  }
+
+  /// Pop the last pushed task, only called by the owner
+  Task *pop() {
+    long B = Bottom.load(std::memory_order_relaxed) - 1;
+    // the store of the bottom and the load of the top must not be reordered
+    Bottom.store(B, std::memory_order_seq_cst);
+    long Tp = Top.load(std::memory_order_seq_cst);
+    if (Tp > B) {
+      Bottom.store(B + 1, std::memory_order_release);
+      return nullptr;
+    }
+
+    Task *T = Buffer[B & Mask].load(std::memory_order_relaxed);
+    if (Tp == B) {
+      // the last task, race against the thieves
+      if (!Top.compare_exchange_strong(Tp, Tp + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed))
+        T = nullptr;
+      Bottom.store(B + 1, std::memory_order_release);
+    }
+    return T;
+  }
+
+  /// Steal the first pushed task, return null if empty or if another thief
+  /// won
+  Task *steal() {
+    long Tp = Top.load(std::memory_order_seq_cst);
+    long B = Bottom.load(std::memory_order_seq_cst);
+    if (Tp >= B)
+      return nullptr;
+
+    Task *T = Buffer[Tp & Mask].load(std::memory_order_relaxed);
+    if (!Top.compare_exchange_strong(Tp, Tp + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed))
+      return nullptr;
+    return T;
+  }
+};
+
+struct Worker {
+  unsigned Id;
+  Deque Queue;
+  char Pad[64];
+  WorkerStatistics Statistics;
+  /// State of the random victim selection
+  unsigned Seed;
+  /// Number of syncs waiting on the native stack of the worker
+  int SyncDepth = 0;
+
+  explicit Worker(unsigned Id) : Id(Id), Seed(Id * 2654435761u + 1) {}
+
+  /// The worker of the calling thread, null outside of the runtime
+  static Worker *&current() {
+    static thread_local Worker *Current = nullptr;
+    return Current;
+  }
+};
+
+class Runtime {
+private:
+  std::vector<std::unique_ptr<Worker>> Workers;
+  std::vector<std::thread> Threads;
+  long Grain;
+
+  std::atomic<bool> Stop{false};
+
+  /// Idle workers sleep until a task is spawned
+  std::mutex SleepLock;
+  std::condition_variable SleepCondition;
+  std::atomic<int> Sleepers{0};
+
+  /// Only one thread at a time runs a root task as worker 0
+  std::mutex RootLock;
+
+  /// Number of failed steal rounds before a worker sleeps
+  static const int SpinRounds = 64;
+
+  static long getEnv(const char *Name, long Default) {
+    const char *Value = std::getenv(Name);
+    long Result = Value ? std::atol(Value) : 0;
+    return Result > 0 ? Result : Default;
+  }
+
+  Runtime() {
+    unsigned Hardware = std::thread::hardware_concurrency();
+    unsigned Count = getEnv("GRAFTER_NUM_THREADS", Hardware ? Hardware : 1);
+    Grain = getEnv("GRAFTER_GRAIN", 64);
+    if (Grain > Deque::Capacity)
+      Grain = Deque::Capacity;
+
+    for (unsigned Id = 0; Id < Count; Id++)
+      Workers.emplace_back(new Worker(Id));
+    // worker 0 is the thread that calls run
+    for (unsigned Id = 1; Id < Count; Id++)
+      Threads.emplace_back([this, Id]() { workerLoop(Workers[Id].get()); });
+  }
+
+  ~Runtime() {
+    if (std::getenv("GRAFTER_STATS"))
+      printStatistics(stderr);
+    Stop = true;
+    {
+      std::lock_guard<std::mutex> Guard(SleepLock);
+      SleepCondition.notify_all();
+    }
+    for (auto &Thread : Threads)
+      Thread.join();
+  }
+
+  void workerLoop(Worker *Self) {
+    Worker::current() = Self;
+    int Failures = 0;
+    while (!Stop.load(std::memory_order_relaxed)) {
+      if (Task *T = stealTask(Self)) {
+        execute(Self, T);
+        Failures = 0;
+        continue;
+      }
+      if (++Failures < SpinRounds) {
+        std::this_thread::yield();
+        continue;
+      }
+
+      // the timeout recovers from a wakeup missed between the check of the
+      // sleepers and the wait
+      std::unique_lock<std::mutex> Guard(SleepLock);
+      Sleepers++;
+      SleepCondition.wait_for(Guard, std::chrono::milliseconds(1));
+      Sleepers--;
+      Failures = 0;
+    }
+  }
+
+public:
+  static Runtime &get() {
+    static Runtime Instance;
+    return Instance;
+  }
+
+  long getGrain() const { return Grain; }
+
+  unsigned getWorkersCount() const { return Workers.size(); }
+
+  /// Try to steal a task from a random worker then from the others
+  Task *stealTask(Worker *Self) {
+    unsigned Count = Workers.size();
+    if (Count < 2)
+      return nullptr;
+    Self->Seed = Self->Seed * 1103515245u + 12345u;
+    unsigned Start = (Self->Seed >> 16) % Count;
+    for (unsigned I = 0; I < Count; I++) {
+      Worker *Victim = Workers[(Start + I) % Count].get();
+      if (Victim == Self)
+        continue;
+      if (Task *T = Victim->Queue.steal()) {
+        WorkerStatistics::bump(Self->Statistics.Stolen);
+        return T;
+      }
+    }
+    WorkerStatistics::bump(Self->Statistics.FailedSteals);
+    return nullptr;
+  }
+
+  /// Wake a sleeping worker after a task was pushed
+  void notifySpawn() {
+    if (Sleepers.load(std::memory_order_relaxed) > 0)
+      SleepCondition.notify_one();
+  }
+
+  inline void execute(Worker *Self, Task *T);
+
+  /// Run the function on the calling thread as worker 0, the tasks it spawns
+  /// run on the workers. Nested calls run the function directly
+  template <typename F> void runRoot(F &&Fn) {
+    if (Worker::current()) {
+      Fn();
+      return;
+    }
+    std::lock_guard<std::mutex> Guard(RootLock);
+    Worker::current() = Workers[0].get();
+    Fn();
+    Worker::current() = nullptr;
+  }
+
+  /// Print the counters of each worker and their total
+  void printStatistics(std::FILE *Out) {
+    unsigned long Total[5] = {};
+    std::fprintf(Out, "grafter runtime: %u workers, grain %ld\n",
+                 getWorkersCount(), Grain);
+    std::fprintf(Out, "  %-8s %12s %12s %12s %12s %14s\n", "worker",
+                 "spawned", "inlined", "executed", "stolen", "failed steals");
+    for (auto &W : Workers) {
+      unsigned long Values[5] = {
+          W->Statistics.Spawned.load(), W->Statistics.Inlined.load(),
+          W->Statistics.Executed.load(), W->Statistics.Stolen.load(),
+          W->Statistics.FailedSteals.load()};
+      std::fprintf(Out, "  %-8u %12lu %12lu %12lu %12lu %14lu\n", W->Id,
+                   Values[0], Values[1], Values[2], Values[3], Values[4]);
+      for (int I = 0; I < 5; I++)
+        Total[I] += Values[I];
+    }
+    std::fprintf(Out, "  %-8s %12lu %12lu %12lu %12lu %14lu\n", "total",
+                 Total[0], Total[1], Total[2], Total[3], Total[4]);
+  }
+};
+
+/// A fork/join scope, the spawned tasks may run on other workers until sync
+/// returns. A group must be synced before it is destroyed
+class TaskGroup {
+public:
+  /// Tasks that can be pending at once in a group, the next spawns run
+  /// inline
+  static const int MaxTasks = 8;
+
+  /// Nested syncs of a worker above which it stops stealing while waiting,
+  /// each stolen task runs on top of the native stack of the sync
+  static const int MaxSyncDepth = 64;
+
+private:
+  friend class Runtime;
+
+  Task Tasks[MaxTasks];
+  int Used = 0;
+  std::atomic<int> Pending{0};
+
+  template <typename Fun> static void runClosure(Task *T) {
+    Fun *Closure = reinterpret_cast<Fun *>(T->Storage);
+    (*Closure)();
+    Closure->~Fun();
+  }
+
+public:
+  TaskGroup() = default;
+  TaskGroup(const TaskGroup &) = delete;
+  TaskGroup &operator=(const TaskGroup &) = delete;
+
+  ~TaskGroup() { sync(); }
+
+  /// Spawn the function as a task, it runs inline if Split is false (the
+  /// cutoff of the caller) or if splitting is not worth it
+  template <typename F> void spawn(F &&Fn, bool Split = true) {
+    typedef typename std::decay<F>::type Fun;
+    Worker *Self = Worker::current();
+    Runtime *RT = Self ? &Runtime::get() : nullptr;
+
+    if (!Split || !Self || Used == MaxTasks ||
+        sizeof(Fun) > Task::StorageSize ||
+        alignof(Fun) > alignof(std::max_align_t) ||
+        Self->Queue.size() >= RT->getGrain()) {
+      if (Self)
+        WorkerStatistics::bump(Self->Statistics.Inlined);
+      Fn();
+      return;
+    }
+
+    Task &T = Tasks[Used];
+    new (T.Storage) Fun(std::forward<F>(Fn));
+    T.Run = &runClosure<Fun>;
+    T.Group = this;
+    Pending.fetch_add(1, std::memory_order_relaxed);
+    if (!Self->Queue.push(&T)) {
+      Pending.fetch_sub(1, std::memory_order_relaxed);
+      WorkerStatistics::bump(Self->Statistics.Inlined);
+      T.Run(&T);
+      return;
+    }
+    Used++;
+    WorkerStatistics::bump(Self->Statistics.Spawned);
+    RT->notifySpawn();
+  }
+
+  /// Wait for the spawned tasks, the worker runs its own tasks then steals
+  /// while some of them run on other workers
+  void sync() {
+    if (Pending.load(std::memory_order_acquire) == 0) {
+      Used = 0;
+      return;
+    }
+
+    Worker *Self = Worker::current();
+    Runtime &RT = Runtime::get();
+    Self->SyncDepth++;
+    while (Pending.load(std::memory_order_acquire) != 0) {
+      // The groups spawned by the tasks of this group are synced before, the
+      // queued tasks of this group are at the bottom of the deque. The tasks
+      // below them belong to the enclosing groups and are left to their
+      // sync, running them here would nest the enclosing traversals
+      Task *T = nullptr;
+      Task *Last = Self->Queue.peek();
+      if (Last && Last->Group == this)
+        T = Self->Queue.pop();
+      // stolen tasks run nested as well, their depth is bounded
+      if (!T && Self->SyncDepth <= MaxSyncDepth)
+        T = RT.stealTask(Self);
+      if (T)
+        RT.execute(Self, T);
+      else
+        std::this_thread::yield();
+    }
+    Self->SyncDepth--;
+    Used = 0;
+  }
+};
+
+inline void Runtime::execute(Worker *Self, Task *T) {
+  TaskGroup *Group = T->Group;
+  T->Run(T);
+  WorkerStatistics::bump(Self->Statistics.Executed);
+  // the group may be destroyed as soon as it sees no pending task
+  Group->Pending.fetch_sub(1, std::memory_order_release);
+}
+
+/// Run a parallel computation rooted at the calling thread
+template <typename F> inline void run(F &&Fn) {
+  Runtime::get().runRoot(std::forward<F>(Fn));
+}
+
+/// Print the statistics of the workers
+inline void printStatistics(std::FILE *Out = stderr) {
+  Runtime::get().printStatistics(Out);
+}
+
+} // namespace grafter
+
+#endif